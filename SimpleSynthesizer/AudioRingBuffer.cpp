@@ -0,0 +1,66 @@
+/*
+	SimpleSynthesizer V0.2
+	Lock-free single-producer/single-consumer ring of 16bit stereo frames.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <cstring>
+#include "AudioRingBuffer.h"
+
+AudioRingBuffer::AudioRingBuffer(size_t frames)
+{
+	capacity = 1;
+	while (capacity < frames)
+		capacity <<= 1;
+	mask = capacity - 1;
+	buffer.resize(capacity * 2);
+}
+
+size_t AudioRingBuffer::Write(const int16_t* data, size_t frames)
+{
+	size_t pos = writePos.load(std::memory_order_relaxed);
+	frames = std::min(frames, capacity - (pos - readPos.load(std::memory_order_acquire)));
+
+	//The frames may wrap around the end of the buffer.
+	size_t start = pos & mask;
+	size_t first = std::min(frames, capacity - start);
+	std::memcpy(&buffer[start * 2], data, first * 2 * sizeof(int16_t));
+	std::memcpy(&buffer[0], data + first * 2, (frames - first) * 2 * sizeof(int16_t));
+
+	writePos.store(pos + frames, std::memory_order_release);
+	return frames;
+}
+
+size_t AudioRingBuffer::Read(int16_t* data, size_t frames)
+{
+	size_t pos = readPos.load(std::memory_order_relaxed);
+	frames = std::min(frames, writePos.load(std::memory_order_acquire) - pos);
+
+	size_t start = pos & mask;
+	size_t first = std::min(frames, capacity - start);
+	std::memcpy(data, &buffer[start * 2], first * 2 * sizeof(int16_t));
+	std::memcpy(data + first * 2, &buffer[0], (frames - first) * 2 * sizeof(int16_t));
+
+	readPos.store(pos + frames, std::memory_order_release);
+	return frames;
+}
+
+void AudioRingBuffer::Reset()
+{
+	writePos.store(0, std::memory_order_relaxed);
+	readPos.store(0, std::memory_order_relaxed);
+}
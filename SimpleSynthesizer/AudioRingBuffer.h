@@ -0,0 +1,54 @@
+/*
+	SimpleSynthesizer V0.2
+	Lock-free single-producer/single-consumer ring of 16bit stereo frames.
+	The render thread writes, the output (a sound device, a file...) reads. Neither side ever waits for the other.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+class AudioRingBuffer
+{
+protected:
+	std::vector<int16_t> buffer;	//Interleaved left and right.
+	size_t capacity;				//In frames, a power of 2.
+	size_t mask;
+
+	//Count of frames ever written and read. Each is stored only by its own side.
+	alignas(64) std::atomic<size_t> writePos{ 0 };
+	alignas(64) std::atomic<size_t> readPos{ 0 };
+
+public:
+	//frames is rounded up to a power of 2.
+	AudioRingBuffer(size_t frames);
+
+	size_t GetCapacity() const { return capacity; }
+	//Frames that can be read now. Exact for the consumer, a lower bound for the producer.
+	size_t GetReadable() const { return writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_acquire); }
+	//Frames that can be written now. Exact for the producer, a lower bound for the consumer.
+	size_t GetWritable() const { return capacity - GetReadable(); }
+
+	//Producer only. Write up to frames frames, returns the count written.
+	size_t Write(const int16_t* data, size_t frames);
+	//Consumer only. Read up to frames frames, returns the count read.
+	size_t Read(int16_t* data, size_t frames);
+	//Empty the ring. Only when neither side is running.
+	void Reset();
+};
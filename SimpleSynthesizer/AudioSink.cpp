@@ -0,0 +1,117 @@
+/*
+	SimpleSynthesizer V0.2
+	Consumers of an AudioStream.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <vector>
+#include <string>
+#include <chrono>
+#include "Tone.h"
+#include "WaveformTone.h"
+#include "AudioStream.h"
+#include "AudioSink.h"
+
+void FileSink::WriteWaveHeader(std::ofstream& file)
+{
+	RIFFHeader riffHeader{ 0x46464952, 0, 0x45564157 };	//"RIFF", "WAVE"
+	WaveFormat waveFormat{ 0x20746d66, sizeof(WaveFormat) - 8, 1, 2, static_cast<uint32_t>(SAMPLE_RATE), static_cast<uint32_t>(SAMPLE_RATE) * 4, 4, 16 };	//"fmt "
+	WaveDataHeader waveDataHeader{ 0x61746164, 0 };	//"data"
+	file.write(reinterpret_cast<const char*>(&riffHeader), sizeof(riffHeader));
+	file.write(reinterpret_cast<const char*>(&waveFormat), sizeof(waveFormat));
+	file.write(reinterpret_cast<const char*>(&waveDataHeader), sizeof(waveDataHeader));
+}
+
+void FileSink::FinishWaveHeader(std::ofstream& file, size_t frames)
+{
+	uint32_t dataSize = static_cast<uint32_t>(frames * 4);
+	uint32_t riffSize = static_cast<uint32_t>(sizeof(RIFFHeader) - 8 + sizeof(WaveFormat) + sizeof(WaveDataHeader)) + dataSize;
+	file.seekp(4, std::ios::beg);
+	file.write(reinterpret_cast<const char*>(&riffSize), sizeof(riffSize));
+	file.seekp(sizeof(RIFFHeader) + sizeof(WaveFormat) + 4, std::ios::beg);
+	file.write(reinterpret_cast<const char*>(&dataSize), sizeof(dataSize));
+}
+
+bool FileSink::Open(AudioStream* stream)
+{
+	Close();
+	file.open(fileName, std::ios::out | std::ios::binary);
+	if (!file)
+		return false;
+	WriteWaveHeader(file);
+	frames = 0;
+	quit = false;
+	thread = std::thread(&FileSink::Worker, this, stream);
+	return true;
+}
+
+void FileSink::Close()
+{
+	quit = true;
+	if (thread.joinable())
+		thread.join();
+	if (file.is_open())
+	{
+		FinishWaveHeader(file, frames);
+		file.close();
+	}
+}
+
+void FileSink::Worker(AudioStream* stream)
+{
+	std::vector<int16_t> buffer(4096 * 2);
+	while (!quit.load(std::memory_order_relaxed))
+	{
+		size_t count = stream->Read(buffer.data(), 4096);
+		if (count > 0)
+		{
+			file.write(reinterpret_cast<const char*>(buffer.data()), count * 4);
+			frames += count;
+		}
+		else if (stream->IsFinished())
+			break;
+		else
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+bool NullSink::Open(AudioStream* stream)
+{
+	Close();
+	quit = false;
+	thread = std::thread(&NullSink::Worker, this, stream);
+	return true;
+}
+
+void NullSink::Close()
+{
+	quit = true;
+	if (thread.joinable())
+		thread.join();
+}
+
+void NullSink::Worker(AudioStream* stream)
+{
+	std::vector<int16_t> buffer(periodFrames * 2);
+	auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(periodFrames / SAMPLE_RATE));
+	auto next = std::chrono::steady_clock::now();
+	while (!quit.load(std::memory_order_relaxed) && !stream->IsFinished())
+	{
+		next += period;
+		std::this_thread::sleep_until(next);
+		stream->Pull(buffer.data(), periodFrames);
+	}
+}
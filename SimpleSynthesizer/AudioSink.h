@@ -0,0 +1,87 @@
+/*
+	SimpleSynthesizer V0.2
+	Consumers of an AudioStream.
+	A sink pulls 16bit stereo frames from the stream in its own thread (or the callback of a sound device).
+	FileSink writes them to a .wav file as fast as they come.
+	NullSink throws them away at the pace of a real sound device, for testing the playback on a machine without one.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <fstream>
+
+class AudioStream;
+
+class AudioSink
+{
+public:
+	virtual ~AudioSink() {}
+
+	//Start pulling frames from the stream.
+	virtual bool Open(AudioStream* stream) = 0;
+	//Stop pulling. The stream may be released after it returns.
+	virtual void Close() = 0;
+};
+
+class FileSink : public AudioSink
+{
+protected:
+	std::string fileName;
+	std::ofstream file;
+	size_t frames{ 0 };
+
+	std::thread thread;
+	std::atomic<bool> quit{ false };
+
+	void Worker(AudioStream* stream);
+
+public:
+	FileSink(const std::string& _fileName) : fileName(_fileName) {}
+	~FileSink() { Close(); }
+
+	virtual bool Open(AudioStream* stream);
+	virtual void Close();
+
+	size_t GetFrames() const { return frames; }
+
+	//Write the headers of a 44.1kHz 16bit stereo .wav file. Sizes are filled in by FinishWaveHeader.
+	static void WriteWaveHeader(std::ofstream& file);
+	static void FinishWaveHeader(std::ofstream& file, size_t frames);
+};
+
+class NullSink : public AudioSink
+{
+protected:
+	size_t periodFrames;
+
+	std::thread thread;
+	std::atomic<bool> quit{ false };
+
+	void Worker(AudioStream* stream);
+
+public:
+	//Pull periodFrames frames once every period, like a sound device does.
+	NullSink(size_t _periodFrames = 512) : periodFrames(_periodFrames) {}
+	~NullSink() { Close(); }
+
+	virtual bool Open(AudioStream* stream);
+	virtual void Close();
+};
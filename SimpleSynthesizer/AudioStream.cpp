@@ -0,0 +1,151 @@
+/*
+	SimpleSynthesizer V0.2
+	Stream the output of a MidiPlayback to an AudioSink through an AudioRingBuffer.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include "MidiFile.h"
+#include "Tone.h"
+#include "MidiPlayback.h"
+#include "AudioStream.h"
+#include "AudioSink.h"
+
+AudioStream::AudioStream(size_t ringFrames, size_t _blockFrames) : ring(ringFrames)
+{
+	blockFrames = _blockFrames < ring.GetCapacity() ? _blockFrames : ring.GetCapacity();
+	block.resize(blockFrames * 2);
+}
+
+AudioStream::~AudioStream()
+{
+	Stop();
+}
+
+bool AudioStream::Start(MidiPlayback* _playback, AudioSink* _sink)
+{
+	Stop();
+
+	playback = _playback;
+	sink = _sink;
+	playback->Rewind();
+	ring.Reset();
+	quit = false;
+	rendered = false;
+	underruns = 0;
+	underrunFrames = 0;
+	periods = 0;
+	xruns = 0;
+	lastRenderTime = 0;
+	maxRenderTime = 0;
+	totalRenderTime = 0;
+	lastDeadline = 0;
+
+	if (!realtime)
+	{
+		//Pre-render, so that the sink starts with a full ring.
+		while (ring.GetWritable() >= blockFrames && RenderBlock())
+			;
+		if (!rendered)
+			renderThread = std::thread(&AudioStream::Render, this);
+	}
+
+	if (!sink->Open(this))
+	{
+		Stop();
+		return false;
+	}
+	return true;
+}
+
+void AudioStream::Stop()
+{
+	quit = true;
+	if (sink)
+		sink->Close();
+	if (renderThread.joinable())
+		renderThread.join();
+	sink = nullptr;
+}
+
+bool AudioStream::RenderBlock()
+{
+	bool playing = playback->PrepareBuffer(reinterpret_cast<char*>(block.data()), blockFrames * 4);
+	ring.Write(block.data(), blockFrames);
+	if (!playing)
+		rendered.store(true, std::memory_order_release);
+	return playing;
+}
+
+void AudioStream::Render()
+{
+	//Half a block of time. The ring is much deeper than a block, so polling at this pace never lets it run dry.
+	auto pollInterval = std::chrono::microseconds(static_cast<long long>(blockFrames * 500000 / SAMPLE_RATE));
+	while (!quit.load(std::memory_order_relaxed))
+	{
+		if (ring.GetWritable() < blockFrames)
+			std::this_thread::sleep_for(pollInterval);
+		else if (!RenderBlock())
+			break;
+	}
+}
+
+size_t AudioStream::RenderPeriod(int16_t* data, size_t frames)
+{
+	if (rendered.load(std::memory_order_relaxed))
+	{
+		std::memset(data, 0, frames * 2 * sizeof(int16_t));
+		return 0;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	if (!playback->PrepareBuffer(reinterpret_cast<char*>(data), frames * 4))
+		rendered.store(true, std::memory_order_release);
+	long long renderTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	long long deadline = static_cast<long long>(frames * 1e9 / SAMPLE_RATE);
+
+	//Only the sink thread writes these, the others just read them.
+	periods.store(periods.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	lastRenderTime.store(renderTime, std::memory_order_relaxed);
+	lastDeadline.store(deadline, std::memory_order_relaxed);
+	totalRenderTime.store(totalRenderTime.load(std::memory_order_relaxed) + renderTime, std::memory_order_relaxed);
+	if (renderTime > maxRenderTime.load(std::memory_order_relaxed))
+		maxRenderTime.store(renderTime, std::memory_order_relaxed);
+	if (renderTime > deadline)
+		xruns.store(xruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	return frames;
+}
+
+size_t AudioStream::Pull(int16_t* data, size_t frames)
+{
+	if (realtime)
+		return RenderPeriod(data, frames);
+
+	size_t count = ring.Read(data, frames);
+	if (count < frames)
+	{
+		std::memset(data + count * 2, 0, (frames - count) * 2 * sizeof(int16_t));
+		if (!rendered.load(std::memory_order_acquire))
+		{
+			underruns.fetch_add(1, std::memory_order_relaxed);
+			underrunFrames.fetch_add(frames - count, std::memory_order_relaxed);
+		}
+	}
+	return count;
+}
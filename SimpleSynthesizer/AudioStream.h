@@ -0,0 +1,109 @@
+/*
+	SimpleSynthesizer V0.2
+	Stream the output of a MidiPlayback to an AudioSink through an AudioRingBuffer.
+	A render thread keeps the ring as full as it can, so that the playback has headroom for slow blocks.
+	The sink (a sound device, a file...) pulls frames from the ring at its own pace.
+	If the ring runs empty before the song ends, the sink gets silence and an underrun is counted.
+	In realtime mode there is no ring and no render thread: each period is rendered right when the sink pulls it,
+	so the latency is only the buffers of the sink. The render time of every period is measured against its deadline,
+	a period rendered slower than real time is counted as an xrun.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "AudioRingBuffer.h"
+
+class MidiPlayback;
+class AudioSink;
+
+constexpr size_t DEFAULT_RING_FRAMES = 8192;	//About 0.19s
+constexpr size_t DEFAULT_STREAM_BLOCK_FRAMES = 512;
+
+class AudioStream
+{
+protected:
+	AudioRingBuffer ring;
+	size_t blockFrames;
+	std::vector<int16_t> block;
+
+	MidiPlayback* playback{ nullptr };
+	AudioSink* sink{ nullptr };
+
+	std::thread renderThread;
+	std::atomic<bool> quit{ false };
+	std::atomic<bool> rendered{ false };	//The whole song has been written to the ring.
+
+	std::atomic<size_t> underruns{ 0 };
+	std::atomic<size_t> underrunFrames{ 0 };
+
+	//Realtime mode
+	bool realtime{ false };
+	std::atomic<size_t> periods{ 0 };
+	std::atomic<size_t> xruns{ 0 };
+	std::atomic<long long> lastRenderTime{ 0 };	//In nanoseconds.
+	std::atomic<long long> maxRenderTime{ 0 };
+	std::atomic<long long> totalRenderTime{ 0 };
+	std::atomic<long long> lastDeadline{ 0 };
+
+	//Render a period for the sink in realtime mode.
+	size_t RenderPeriod(int16_t* data, size_t frames);
+
+	//Render one block to the ring. Returns false at the end of the song.
+	bool RenderBlock();
+	void Render();
+
+public:
+	//ringFrames is the depth of the ring, blockFrames the frames rendered at a time.
+	AudioStream(size_t ringFrames = DEFAULT_RING_FRAMES, size_t _blockFrames = DEFAULT_STREAM_BLOCK_FRAMES);
+	~AudioStream();
+
+	//Render every period when the sink pulls it, instead of rendering ahead into the ring. Call before Start.
+	//The periods of a realtime sink should be short (64 - 256 frames). The render path neither allocates nor does I/O
+	//as long as MidiPlayback::printMessages is off.
+	void SetRealtime(bool _realtime) { realtime = _realtime; }
+	bool IsRealtime() const { return realtime; }
+
+	//Rewind the playback, fill up the ring, then start the render thread and the sink.
+	bool Start(MidiPlayback* _playback, AudioSink* _sink);
+	//Stop the sink and the render thread.
+	void Stop();
+
+	//The whole song has been rendered and pulled by the sink.
+	bool IsFinished() const { return rendered.load(std::memory_order_acquire) && ring.GetReadable() == 0; }
+
+	//For the sink. Read frames, fill the missing ones with silence and count an underrun if the song has not ended.
+	//Returns the count of frames read from the ring.
+	size_t Pull(int16_t* data, size_t frames);
+	//For the sink. Read up to frames frames without padding, for a sink that is not paced (a file).
+	size_t Read(int16_t* data, size_t frames) { return ring.Read(data, frames); }
+
+	size_t GetRingFrames() const { return ring.GetCapacity(); }
+	size_t GetBufferedFrames() const { return ring.GetReadable(); }
+	size_t GetUnderruns() const { return underruns.load(std::memory_order_relaxed); }
+	size_t GetUnderrunFrames() const { return underrunFrames.load(std::memory_order_relaxed); }
+
+	//Statistics of realtime mode. Times are in seconds.
+	size_t GetPeriods() const { return periods.load(std::memory_order_relaxed); }
+	size_t GetXruns() const { return xruns.load(std::memory_order_relaxed); }
+	double GetLastRenderTime() const { return lastRenderTime.load(std::memory_order_relaxed) / 1e9; }
+	double GetMaxRenderTime() const { return maxRenderTime.load(std::memory_order_relaxed) / 1e9; }
+	double GetMeanRenderTime() const { size_t count = GetPeriods(); return count ? totalRenderTime.load(std::memory_order_relaxed) / 1e9 / count : 0; }
+	double GetDeadline() const { return lastDeadline.load(std::memory_order_relaxed) / 1e9; }
+};
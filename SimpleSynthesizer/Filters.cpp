@@ -12,7 +12,7 @@ LowPassFilter_1Order::LowPassFilter_1Order()
 
 void LowPassFilter_1Order::UpdateParam(double cutOffFreq, double sampleRate)
 {
-    prevVout = 0;
+    //The output is kept, so that the cut off frequency can be changed while the filter is running.
     double RC = cutOffFreq == 0 ? 0 : 0.5 / pi / cutOffFreq;
     Cof1 = 1 / (1 + RC * sampleRate);
     Cof2 = 1 - Cof1;
@@ -26,6 +26,24 @@ double LowPassFilter_1Order::TriggerPulse(const double& vIn)
     return vOut;
 }
 
+void LowPassFilter_1Order::Process(double* data, size_t frames)
+{
+    if (frames == 0)
+        return;
+    if (Cof2 == 0)
+    {
+        prevVout = data[frames - 1];
+        return;
+    }
+    double vOut = prevVout;
+    for (size_t i = 0; i < frames; i++)
+    {
+        vOut = Cof1 * data[i] + Cof2 * vOut;
+        data[i] = vOut;
+    }
+    prevVout = vOut;
+}
+
 HighPassFilter_1Order::HighPassFilter_1Order()
 {
     prevVin = prevVout = 0;
@@ -61,14 +79,18 @@ BandPassFilter::BandPassFilter()
 
 void BandPassFilter::UpdateParam(double centerFreq, double bandWidth, int scaleFactor, double sampleRate)
 {
+    //The output is kept, so that the center frequency can be changed while the filter is running.
     c = exp(-2 * pi * bandWidth / sampleRate);
     b = -4 * c / (1 + c) * cos(2 * pi * centerFreq / sampleRate);
     if (scaleFactor == 1)
         a = sqrt(1 - b * b / (4 * c)) * (1 - c);
     else
         a = sqrt(((1 + c) * (1 + c) - b * b) * (1 - c) / (1 + c));
+}
 
-    y0 = y1 = 0;
+void BandPassFilter::Mute()
+{
+    a = b = c = 0;
 }
 
 double BandPassFilter::TriggerPulse(const double& vIn)
@@ -78,4 +100,31 @@ double BandPassFilter::TriggerPulse(const double& vIn)
     y0 = y1;
     y1 = y;
     return y;
+}
+
+void BandPassFilter::Mix(double* data, size_t frames, double gain)
+{
+    if (frames == 0)
+        return;
+    if (a == 0 && b == 0 && c == 0)
+    {
+        y0 = y1 = 0;
+        return;
+    }
+    if (a == 1 && b == 0 && c == 0)
+    {
+        y0 = frames > 1 ? data[frames - 2] : y1;
+        y1 = data[frames - 1];
+        for (size_t i = 0; i < frames; i++)
+            data[i] *= 1 + gain;
+        return;
+    }
+    for (size_t i = 0; i < frames; i++)
+    {
+        //y0 is known a sample earlier, so only b * y1 waits for the previous output.
+        double y = (a * data[i] - c * y0) - b * y1;
+        y0 = y1;
+        y1 = y;
+        data[i] += y * gain;
+    }
 }
\ No newline at end of file
@@ -14,6 +14,8 @@ public:
     LowPassFilter_1Order();
     void UpdateParam(double cutOffFreq, double sampleRate);
     double TriggerPulse(const double& vIn);
+    //Filter a block in place. A cut off frequency of 0 passes the signal unchanged, then the block is not filtered.
+    void Process(double* data, size_t frames);
 };
 
 
@@ -59,5 +61,10 @@ protected:
 public:
     BandPassFilter();
     void UpdateParam(double centerFreq, double bandWidth, int scaleFactor, double sampleRate);
+    //The filter outputs nothing until its params are set again.
+    void Mute();
     double TriggerPulse(const double& vIn);
+    //Add the filtered block times gain to the block. A filter whose params are never set passes the signal unchanged,
+    //then the block is only scaled. A muted filter leaves the block unchanged.
+    void Mix(double* data, size_t frames, double gain);
 };
\ No newline at end of file
@@ -0,0 +1,249 @@
+/*
+	SimpleSynthesizer V0.2
+	Interpolation of the waveform samples, in selectable quality.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <memory>
+#include "Tone.h"
+#include "Interpolation.h"
+
+constexpr double SINC_CUTOFF = 0.9;	//Of the Nyquist frequency, at a transposition of 1. The rest is the transition band of the window.
+
+//Polyphase windowed sinc kernels of TAPS taps.
+//Tap t of a row multiplies the sample at pos - TAPS / 2 + 1 + t, where pos is the integer part of the position.
+template<int TAPS>
+class SincKernel
+{
+protected:
+	//[level][phase][tap]. There are SINC_PHASES + 1 phases, so that the last phase can be blended with the next sample.
+	std::vector<float> coefficients;
+
+public:
+	SincKernel() : coefficients(static_cast<size_t>(SINC_LEVELS) * (SINC_PHASES + 1) * TAPS)
+	{
+		for (int level = 0; level < SINC_LEVELS; level++)
+		{
+			double cutoff = SINC_CUTOFF / std::pow(2, level * 0.5);
+			for (int phase = 0; phase <= SINC_PHASES; phase++)
+			{
+				float* row = Get(level, phase);
+				double fraction = static_cast<double>(phase) / SINC_PHASES;
+				double sum = 0;
+				for (int t = 0; t < TAPS; t++)
+				{
+					double x = t - TAPS / 2 + 1 - fraction;	//Distance of the tap from the position.
+					double sinc = x == 0 ? 1 : std::sin(pi * cutoff * x) / (pi * cutoff * x);
+					double u = x / (TAPS / 2);
+					double window = std::fabs(u) >= 1 ? 0 : 0.42 + 0.5 * std::cos(pi * u) + 0.08 * std::cos(pi2 * u);	//Blackman
+					row[t] = static_cast<float>(sinc * window);
+					sum += row[t];
+				}
+				//A constant signal keeps its level.
+				for (int t = 0; t < TAPS; t++)
+					row[t] = static_cast<float>(row[t] / sum);
+			}
+		}
+	}
+
+	float* Get(int level, int phase)
+	{
+		return coefficients.data() + (static_cast<size_t>(level) * (SINC_PHASES + 1) + phase) * TAPS;
+	}
+	const float* Get(int level, int phase) const
+	{
+		return coefficients.data() + (static_cast<size_t>(level) * (SINC_PHASES + 1) + phase) * TAPS;
+	}
+
+	//The level that does not alias at a transposition of ratio.
+	static int GetLevel(double ratio)
+	{
+		int level = 0;
+		double maxRatio = 1;
+		while (level < SINC_LEVELS - 1 && ratio > maxRatio)
+		{
+			level++;
+			maxRatio *= std::sqrt(2.0);
+		}
+		return level;
+	}
+};
+
+static std::unique_ptr<const SincKernel<8>> sinc8Kernel;
+static std::unique_ptr<const SincKernel<16>> sinc16Kernel;
+
+void Interpolation::Initialize()
+{
+	sinc8Kernel.reset(new SincKernel<8>());
+	sinc16Kernel.reset(new SincKernel<16>());
+}
+
+constexpr double FRACTION_SCALE = 1 / PHASE_ONE;
+
+//The kernels read CHANNELS interleaved samples per frame. The right channel is only written for 2 channels.
+template<int CHANNELS>
+static void RenderLinear(const int16_t* data, const uint64_t* phases, double* left, double* right, int count)
+{
+	for (int n = 0; n < count; n++)
+	{
+		const int16_t* frame = data + (phases[n] >> PHASE_FRACTION_BITS) * CHANNELS;
+		double linear = (phases[n] & PHASE_FRACTION_MASK) * FRACTION_SCALE;	//This should be in 0 - 1
+		left[n] = frame[0] * (1 - linear) + frame[CHANNELS] * linear;
+		if (CHANNELS == 2)
+			right[n] = frame[1] * (1 - linear) + frame[CHANNELS + 1] * linear;
+	}
+}
+
+static double Cubic(double y0, double y1, double y2, double y3, double x)
+{
+	double c1 = 0.5 * (y2 - y0);
+	double c2 = y0 - 2.5 * y1 + 2 * y2 - 0.5 * y3;
+	double c3 = 0.5 * (y3 - y0) + 1.5 * (y1 - y2);
+	return ((c3 * x + c2) * x + c1) * x + y1;
+}
+
+template<int CHANNELS>
+static void RenderCubic(const int16_t* data, size_t size, const uint64_t* phases, double* left, double* right, int count)
+{
+	for (int n = 0; n < count; n++)
+	{
+		size_t pos = static_cast<size_t>(phases[n] >> PHASE_FRACTION_BITS);
+		double x = (phases[n] & PHASE_FRACTION_MASK) * FRACTION_SCALE;
+		//The points out of the waveform repeat its first and last frame.
+		const int16_t* f0 = data + (pos > 0 ? pos - 1 : 0) * CHANNELS;
+		const int16_t* f1 = data + pos * CHANNELS;
+		const int16_t* f2 = f1 + CHANNELS;
+		const int16_t* f3 = data + (pos + 2 < size ? pos + 2 : size - 1) * CHANNELS;
+		left[n] = Cubic(f0[0], f1[0], f2[0], f3[0], x);
+		if (CHANNELS == 2)
+			right[n] = Cubic(f0[1], f1[1], f2[1], f3[1], x);
+	}
+}
+
+template<int TAPS, int CHANNELS>
+static void RenderSinc(const SincKernel<TAPS>& kernel, const int16_t* data, size_t size, const uint64_t* phases, double* left, double* right, int count, double ratio)
+{
+	constexpr int LANES = 4;	//Partial sums kept apart, so that the taps are added in a fixed order that can be vectorized.
+	constexpr int HALF = TAPS / 2;
+	//The high bits of the fraction select the row of the kernel, the rest blend it with the next row.
+	constexpr int BLEND_BITS = PHASE_FRACTION_BITS - SINC_PHASE_BITS;
+	constexpr float BLEND_SCALE = 1.0f / (uint64_t(1) << BLEND_BITS);
+	int level = SincKernel<TAPS>::GetLevel(ratio);
+	for (int n = 0; n < count; n++)
+	{
+		size_t pos = static_cast<size_t>(phases[n] >> PHASE_FRACTION_BITS);
+		uint32_t fraction = static_cast<uint32_t>(phases[n] & PHASE_FRACTION_MASK);
+		int phase = static_cast<int>(fraction >> BLEND_BITS);
+		float blend = (fraction & ((uint32_t(1) << BLEND_BITS) - 1)) * BLEND_SCALE;
+		const float* row0 = kernel.Get(level, phase);
+		const float* row1 = row0 + TAPS;
+		//The blended row is shared by the channels.
+		float row[TAPS];
+		for (int t = 0; t < TAPS; t++)
+			row[t] = row0[t] + (row1[t] - row0[t]) * blend;
+
+		float taps[CHANNELS][TAPS];
+		if (pos >= HALF - 1 && pos + HALF < size)
+		{
+			const int16_t* first = data + (pos - (HALF - 1)) * CHANNELS;
+			for (int t = 0; t < TAPS; t++)
+				for (int c = 0; c < CHANNELS; c++)
+					taps[c][t] = first[t * CHANNELS + c];
+		}
+		else
+		{
+			//Near the ends, the taps out of the waveform repeat its first and last frame.
+			for (int t = 0; t < TAPS; t++)
+			{
+				long long index = static_cast<long long>(pos) - (HALF - 1) + t;
+				index = index < 0 ? 0 : (index >= static_cast<long long>(size) ? static_cast<long long>(size) - 1 : index);
+				for (int c = 0; c < CHANNELS; c++)
+					taps[c][t] = data[index * CHANNELS + c];
+			}
+		}
+
+		for (int c = 0; c < CHANNELS; c++)
+		{
+			float sums[LANES] = {};
+			for (int t = 0; t < TAPS; t += LANES)
+			{
+				for (int k = 0; k < LANES; k++)
+					sums[k] += row[t + k] * taps[c][t + k];
+			}
+			(c == 0 ? left : right)[n] = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+		}
+	}
+}
+
+template<int CHANNELS>
+static void Render(InterpolationQuality quality, const int16_t* data, size_t size, const uint64_t* phases, double* left, double* right, int count, double ratio)
+{
+	switch (quality)
+	{
+	case InterpolationQuality::Cubic:
+		RenderCubic<CHANNELS>(data, size, phases, left, right, count);
+		break;
+	case InterpolationQuality::Sinc8:
+		RenderSinc<8, CHANNELS>(*sinc8Kernel, data, size, phases, left, right, count, ratio);
+		break;
+	case InterpolationQuality::Sinc16:
+		RenderSinc<16, CHANNELS>(*sinc16Kernel, data, size, phases, left, right, count, ratio);
+		break;
+	default:
+		RenderLinear<CHANNELS>(data, phases, left, right, count);
+		break;
+	}
+}
+
+void Interpolation::Render(InterpolationQuality quality, const int16_t* data, size_t size, int channels, const uint64_t* phases, double* left, double* right, int count, double ratio)
+{
+	if (channels == 2)
+		::Render<2>(quality, data, size, phases, left, right, count, ratio);
+	else
+		::Render<1>(quality, data, size, phases, left, right, count, ratio);
+}
+
+const char* Interpolation::GetName(InterpolationQuality quality)
+{
+	switch (quality)
+	{
+	case InterpolationQuality::Cubic:
+		return "cubic";
+	case InterpolationQuality::Sinc8:
+		return "sinc8";
+	case InterpolationQuality::Sinc16:
+		return "sinc16";
+	default:
+		return "linear";
+	}
+}
+
+bool Interpolation::FromName(const char* name, InterpolationQuality& quality)
+{
+	for (InterpolationQuality item : { InterpolationQuality::Linear, InterpolationQuality::Cubic, InterpolationQuality::Sinc8, InterpolationQuality::Sinc16 })
+	{
+		if (std::strcmp(name, GetName(item)) == 0)
+		{
+			quality = item;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,66 @@
+/*
+	SimpleSynthesizer V0.2
+	Interpolation of the waveform samples, in selectable quality.
+	Linear is the cheapest. Cubic is a 4 point Hermite spline. Sinc8 and Sinc16 are windowed sinc filters read from
+	polyphase tables built at startup: one row of taps per fraction of a sample, the rows of two neighbour fractions are blended.
+	A sample transposed up is read faster than it was recorded, which aliases its highest partials. The sinc tables are
+	built in levels that cut off lower for higher transpositions, the way the mipmaps of the wavetables do.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+//A position in a waveform is a fixed point number: the sample index in the high 32 bits, the fraction of a sample in the low 32 bits.
+//Adding a step to it is exact, so a tone does not drift however long it plays.
+constexpr int PHASE_FRACTION_BITS = 32;
+constexpr uint64_t PHASE_FRACTION_MASK = (uint64_t(1) << PHASE_FRACTION_BITS) - 1;
+constexpr double PHASE_ONE = 4294967296.0;	//A position of 1 sample.
+
+constexpr int INTERPOLATION_REACH = 8;		//Frames after the position that the widest kernel reads.
+
+constexpr int SINC_PHASE_BITS = 7;
+constexpr int SINC_PHASES = 1 << SINC_PHASE_BITS;	//Fractions of a sample the sinc kernels are tabulated for.
+constexpr int SINC_LEVELS = 5;		//Kernels for transpositions up to 1, 1.4, 2, 2.8 and 4 times. Higher ones use the last level.
+
+enum class InterpolationQuality
+{
+	Linear,		//2 points.
+	Cubic,		//4 point Hermite.
+	Sinc8,		//8 tap windowed sinc.
+	Sinc16		//16 tap windowed sinc.
+};
+
+class Interpolation
+{
+public:
+	//Build the sinc kernels. Called by Tone::InitializeTables.
+	static void Initialize();
+
+	//Read count frames of data at phases to left and right. data holds size frames of 1 or 2 interleaved channels,
+	//right is only written for 2 channels. The index of every phase should be less than size - 1.
+	//ratio is the transposition, frames of data read per output frame.
+	static void Render(InterpolationQuality quality, const int16_t* data, size_t size, int channels, const uint64_t* phases, double* left, double* right, int count, double ratio);
+
+	//The fixed point phase of a position in samples, rounded to the nearest. position should not be negative.
+	static uint64_t ToPhase(double position) { return static_cast<uint64_t>(position * PHASE_ONE + 0.5); }
+
+	static const char* GetName(InterpolationQuality quality);
+	//Returns false if name is not linear, cubic, sinc8 or sinc16.
+	static bool FromName(const char* name, InterpolationQuality& quality);
+};
@@ -0,0 +1,166 @@
+/*
+	SimpleSynthesizer V0.2
+	Read only memory mapped file.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const std::filesystem::path& path, bool prefetch)
+{
+	Close();
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize{};
+	HANDLE mapping = nullptr;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+		mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping != nullptr)
+	{
+		//The view keeps the mapping and the file open.
+		data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+	if (data == nullptr)
+		return false;
+	size = static_cast<size_t>(fileSize.QuadPart);
+
+	if (prefetch)
+		Prefetch(0, size);
+	return true;
+}
+
+void MappedFile::Prefetch(size_t offset, size_t bytes) const
+{
+	if (data == nullptr || offset >= size)
+		return;
+	WIN32_MEMORY_RANGE_ENTRY range{ const_cast<uint8_t*>(data + offset), (std::min)(bytes, size - offset) };
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+bool MappedFile::Lock(size_t offset, size_t bytes) const
+{
+	if (data == nullptr || offset >= size)
+		return false;
+	return VirtualLock(const_cast<uint8_t*>(data + offset), (std::min)(bytes, size - offset)) != 0;
+}
+
+void MappedFile::Drop(size_t offset, size_t bytes) const
+{
+	if (data == nullptr || offset >= size)
+		return;
+	static const size_t pageSize = []() { SYSTEM_INFO info; GetSystemInfo(&info); return static_cast<size_t>(info.dwPageSize); }();
+	size_t start = (offset + pageSize - 1) / pageSize * pageSize;
+	size_t end = (offset + (std::min)(bytes, size - offset)) / pageSize * pageSize;
+	//Unlocking pages that are not locked takes them out of the working set.
+	if (end > start)
+		VirtualUnlock(const_cast<uint8_t*>(data + start), end - start);
+}
+
+void MappedFile::Close()
+{
+	if (data != nullptr)
+		UnmapViewOfFile(data);
+	data = nullptr;
+	size = 0;
+}
+
+#else
+
+bool MappedFile::Open(const std::filesystem::path& path, bool prefetch)
+{
+	Close();
+	int file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+	struct stat status {};
+	void* view = MAP_FAILED;
+	if (fstat(file, &status) == 0 && status.st_size > 0)
+	{
+		int flags = MAP_PRIVATE;
+#if defined(MAP_POPULATE)
+		if (prefetch)
+			flags |= MAP_POPULATE;
+#endif
+		view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, flags, file, 0);
+	}
+	//The mapping keeps the file open.
+	close(file);
+	if (view == MAP_FAILED)
+		return false;
+	data = static_cast<const uint8_t*>(view);
+	size = static_cast<size_t>(status.st_size);
+
+	if (prefetch)
+		Prefetch(0, size);
+	return true;
+}
+
+void MappedFile::Prefetch(size_t offset, size_t bytes) const
+{
+	if (data == nullptr || offset >= size)
+		return;
+	//madvise takes whole pages.
+	static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t start = offset / pageSize * pageSize;
+	size_t end = offset + (std::min)(bytes, size - offset);
+	madvise(const_cast<uint8_t*>(data + start), end - start, MADV_WILLNEED);
+}
+
+bool MappedFile::Lock(size_t offset, size_t bytes) const
+{
+	if (data == nullptr || offset >= size)
+		return false;
+	return mlock(data + offset, (std::min)(bytes, size - offset)) == 0;
+}
+
+void MappedFile::Drop(size_t offset, size_t bytes) const
+{
+	if (data == nullptr || offset >= size)
+		return;
+	//Only the pages wholly within the range, the others hold bytes of the neighbouring waveforms.
+	static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t start = (offset + pageSize - 1) / pageSize * pageSize;
+	size_t end = (offset + (std::min)(bytes, size - offset)) / pageSize * pageSize;
+	if (end > start)
+		madvise(const_cast<uint8_t*>(data + start), end - start, MADV_DONTNEED);
+}
+
+void MappedFile::Close()
+{
+	if (data != nullptr)
+		munmap(const_cast<uint8_t*>(data), size);
+	data = nullptr;
+	size = 0;
+}
+
+#endif
@@ -0,0 +1,56 @@
+/*
+	SimpleSynthesizer V0.2
+	Read only memory mapped file.
+	The pages of a mapped file are read by the system when they are first touched and are shared by every process that maps
+	the same file, so several renderers loading one waveform bank keep one copy of it in memory.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <filesystem>
+
+class MappedFile
+{
+protected:
+	const uint8_t* data{ nullptr };
+	size_t size{ 0 };
+
+public:
+	MappedFile() {}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator = (const MappedFile&) = delete;
+	~MappedFile() { Close(); }
+
+	//Map the whole file. Returns false if it can not be opened or mapped, or if it is empty.
+	//prefetch asks the system to read all of the file ahead, instead of a page at a time when it is touched.
+	bool Open(const std::filesystem::path& path, bool prefetch);
+	void Close();
+
+	//Ask the system to read bytes at offset ahead. Returns at once.
+	void Prefetch(size_t offset, size_t bytes) const;
+	//Keep bytes at offset in memory until the file is closed. Returns false if the system refuses,
+	//which it does when the process has locked as much as it may.
+	bool Lock(size_t offset, size_t bytes) const;
+	//Let the system take back the memory of the whole pages within bytes at offset, which are read from the file again
+	//if they are touched later. The range must not hold locked pages.
+	void Drop(size_t offset, size_t bytes) const;
+
+	const uint8_t* GetData() const { return data; }
+	size_t GetSize() const { return size; }
+};
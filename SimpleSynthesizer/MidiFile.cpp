@@ -21,6 +21,7 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <algorithm>
 #include "MidiFile.h"
 
 //Load a midi file and interpret its content to tracks.
@@ -190,4 +191,56 @@ void MidiDataCore::LoadMidiFile(std::string fileName)
     }
 
     file.close();
-}
\ No newline at end of file
+}
+
+//Write a variable length quantity.
+static void WriteVLQ(std::vector<uint8_t>& data, uint32_t value)
+{
+    uint8_t bytes[5];
+    int count = 0;
+    do
+    {
+        bytes[count++] = value & 0x7f;
+        value >>= 7;
+    } while (value > 0);
+    while (count > 1)
+        data.push_back(bytes[--count] | 0x80);
+    data.push_back(bytes[0]);
+}
+
+static void WriteBigEndian(std::vector<uint8_t>& data, uint32_t value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--)
+        data.push_back((value >> (i * 8)) & 0xff);
+}
+
+bool WriteMidiFile(const std::string& fileName, uint16_t timeBase, std::vector<std::vector<MidiWriteEvent>> tracks)
+{
+    std::vector<uint8_t> song{ 'M', 'T', 'h', 'd' };
+    WriteBigEndian(song, 6, 4);
+    WriteBigEndian(song, 1, 2);
+    WriteBigEndian(song, static_cast<uint32_t>(tracks.size()), 2);
+    WriteBigEndian(song, timeBase, 2);
+
+    for (auto& track : tracks)
+    {
+        std::stable_sort(track.begin(), track.end(), [](const MidiWriteEvent& a, const MidiWriteEvent& b) { return a.tick < b.tick; });
+        std::vector<uint8_t> events;
+        uint32_t tick = 0;
+        for (auto& item : track)
+        {
+            WriteVLQ(events, item.tick - tick);
+            events.insert(events.end(), item.bytes.begin(), item.bytes.end());
+            tick = item.tick;
+        }
+        WriteVLQ(events, 0);
+        events.insert(events.end(), { E_NonMidi, M_EndOfTrack, 0 });
+
+        song.insert(song.end(), { 'M', 'T', 'r', 'k' });
+        WriteBigEndian(song, static_cast<uint32_t>(events.size()), 4);
+        song.insert(song.end(), events.begin(), events.end());
+    }
+    std::ofstream file(fileName, std::ios::out | std::ios::binary);
+    file.write(reinterpret_cast<const char*>(song.data()), song.size());
+    return static_cast<bool>(file);
+}
@@ -159,3 +159,14 @@ public:
 
     void LoadMidiFile(std::string fileName);
 };
+
+//An event of a track to be written by WriteMidiFile, at an absolute tick. The bytes are the status byte and the params.
+struct MidiWriteEvent
+{
+    uint32_t tick;
+    std::vector<uint8_t> bytes;
+};
+
+//Write the tracks to a format 1 midi file, for generated songs. The events of a track are sorted by tick, events of the same
+//tick keep their order, and an end of track is appended. Returns false if the file cannot be written.
+bool WriteMidiFile(const std::string& fileName, uint16_t timeBase, std::vector<std::vector<MidiWriteEvent>> tracks);
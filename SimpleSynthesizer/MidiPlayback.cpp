@@ -22,6 +22,10 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <iterator>
 #include "MidiFile.h"
 #include "Tone.h"
 #include "MidiPlayback.h"
@@ -31,42 +35,49 @@
 #include <chrono>
 #endif
 
-void MidiPlayback::ChannelStatus::ParseEvent(const uint8_t& event, const std::vector<uint8_t>& params)
+void MidiPlayback::ChannelStatus::ParseEvent(const uint8_t& event, const std::vector<uint8_t>& params, bool printMessages)
 {
 	if (event == E_NoteOn || event == E_NoteOff)
 	{
 		if (params[1] > 0 && event == E_NoteOn)
 		{
-			for (Tone*& p : pTones)
+			Tone* p = nullptr;
+			if (toneCount < MAX_POLYPHONICS)
 			{
-				if (p == nullptr)
+				if (percussionBank >= 0)	//Percussion channel
+					p = Tone::CreateTone(voicePool, percussionBank + 512, instrumentID, params[0], params[1]);
+				else 	//other channel
+					p = Tone::CreateTone(voicePool, instrumentBank, instrumentID, params[0], params[1]);
+			}
+			if (p)	//Otherwise the channel is full, drop the note.
+			{
+				//Later changes are pushed by PushParams.
+				p->SetSustain(sustain);
+				p->SetModulation(modulationDepth, modulationSpeed);
+				if (pitchBend != 8192)
+					p->PitchBend(pitchBend, pitchBendDepth);
+				if (percussionBank < 0)
 				{
-					if (percussionBank >= 0)	//Percussion channel
-						p = Tone::CreateTone(percussionBank + 512, instrumentID, params[0], params[1]);
-					else 	//other channel
-					{
-						p = Tone::CreateTone(instrumentBank, instrumentID, params[0], params[1]);
-						p->SetResonanceFreq(resonance);
-						p->SetFilterCutoffFreq(cutOff);
-						if (portamentoEnable)
-							p->SetPortamentoPitch(lastPitch == -1 ? params[0] : lastPitch, portamentoTime);
-					}
-					p->SetSoft(soft);
-					lastPitch = params[0];
-					break;
+					p->SetResonanceFreq(resonance);
+					p->SetFilterCutoffFreq(voiceCutOff);
+					if (portamentoEnable)
+						p->SetPortamentoPitch(lastPitch == -1 ? params[0] : lastPitch, portamentoTime);
 				}
+				p->SetSoft(soft);
+				lastPitch = params[0];
+				//Not the quietest before it has been rendered.
+				voices[toneCount] = { p, 0, std::numeric_limits<SampleType>::max(), -1, params[0], false, -1 };
+				LinkKey(toneCount++);
 			}
 		}
 		else
 		{
-			for (Tone*& p : pTones)
+			int n = keyFirst[params[0] & 0x7f];
+			if (n >= 0)
 			{
-				if (p && static_cast<uint8_t>(p->GetPitch()) == params[0] && !p->IsReleasing())
-				{
-					lastPitch = -1;
-					p->ReleaseKey(64);// params[1]);
-					break;
-				}
+				lastPitch = -1;
+				voices[n].tone->ReleaseKey(64);// params[1]);
+				UnlinkKey(n);
 			}
 		}
 	}
@@ -80,9 +91,6 @@ void MidiPlayback::ChannelStatus::ParseEvent(const uint8_t& event, const std::ve
 	}
 	else if (event == E_Controller)
 	{
-		bool resonanceChange = false;
-		bool cutOffChange = false;
-
 		switch (params[0])
 		{
 		case C_BankSelectMSB:
@@ -114,15 +122,18 @@ void MidiPlayback::ChannelStatus::ParseEvent(const uint8_t& event, const std::ve
 			break;
 		case C_HoldPedal:
 			sustain = (params[1] > 63);
+			sustainChanged = true;
 			break;
 		case C_SoftPedal:
 			soft = (params[1] > 63);
 			break;
 		case C_ModulationWheelCoarse:
 			modulationDepth = params[1];
+			modulationChanged = true;
 			break;
 		case C_ModulationWheelFine:
 			modulationSpeed = params[1];
+			modulationChanged = true;
 			break;
 		case C_PortamentoTimeCoarse:
 			portamentoTime = params[1];
@@ -135,12 +146,15 @@ void MidiPlayback::ChannelStatus::ParseEvent(const uint8_t& event, const std::ve
 			lastPitch = params[1];
 			break;
 		case C_SoundTimbre:	//I don't know the exact effect of this control in XG mode.
-			resonanceChange = true;
 //			resonance = params[1] * 30;
+//			resonanceChanged = true;
 			break;
 		case C_SoundBrightness:	//I don't know the exact effect of this control in XG mode.
-			cutOffChange = true;
 			cutOff = (127 - params[1]) * 30;
+			cutOffChanged = true;
+#if (!SMOOTH_FILTER_CUTOFF)
+			voiceCutOff = cutOff;
+#endif
 			break;
 		case C_EffectsLevel:
 			//Yamaha XG seems to use EffectsLevel to control reverb depth.
@@ -182,82 +196,255 @@ void MidiPlayback::ChannelStatus::ParseEvent(const uint8_t& event, const std::ve
 			break;
 		default:
 			//Not implemented, just print out.
-			std::cout << " + " << (int)params[0] << " " << (int)params[1] << std::endl;
+			if (printMessages)
+				std::cout << " + " << (int)params[0] << " " << (int)params[1] << std::endl;
 			break;
 		}
 	}
 	else if (event == E_PitchBend)
 	{
-		short value = (static_cast<short>(params[0]) & 0x7f) | (params[1] << 7);
-		for (int n = MAX_POLYPHONICS - 1; n >= 0; n--)
+		pitchBend = (params[0] & 0x7f) | ((params[1] & 0x7f) << 7);
+		pitchBendChanged = true;
+	}
+}
+
+void MidiPlayback::ChannelStatus::PushParams(size_t frames)
+{
+	if (cutOffChanged)
+	{
+#if (SMOOTH_FILTER_CUTOFF)
+		//Glide exponentially, by the part of the distance that the frames of this block cover, so that the glide
+		//takes the same time whatever the block length is. 0 means no filter, there is nothing to glide from or to.
+		double glide = 1 - std::exp(-static_cast<double>(frames) / CUTOFF_GLIDE_FRAMES);
+		if (voiceCutOff == 0 || cutOff == 0 || std::fabs(cutOff - voiceCutOff) < 1)
+			voiceCutOff = cutOff;
+		else
+			voiceCutOff += (cutOff - voiceCutOff) * glide;
+#else
+		voiceCutOff = cutOff;
+#endif
+	}
+
+	for (int n = 0; n < toneCount; n++)
+	{
+		Tone* p = voices[n].tone;
+		if (sustainChanged)
+			p->SetSustain(sustain);
+		if (modulationChanged)
+			p->SetModulation(modulationDepth, modulationSpeed);
+		if (pitchBendChanged)
+			p->PitchBend(pitchBend, pitchBendDepth);
+		if (cutOffChanged && percussionBank < 0)
+			p->SetFilterCutoffFreq(voiceCutOff);
+		if (resonanceChanged && percussionBank < 0)
+			p->SetResonanceFreq(resonance);
+	}
+	sustainChanged = false;
+	modulationChanged = false;
+	pitchBendChanged = false;
+	resonanceChanged = false;
+	cutOffChanged = (voiceCutOff != cutOff);
+}
+
+void MidiPlayback::ChannelStatus::LinkKey(int n)
+{
+	Voice& voice = voices[n];
+	voice.keyDown = true;
+	voice.nextSameKey = -1;
+	if (keyLast[voice.key] < 0)
+		keyFirst[voice.key] = static_cast<int8_t>(n);
+	else
+		voices[keyLast[voice.key]].nextSameKey = static_cast<int8_t>(n);
+	keyLast[voice.key] = static_cast<int8_t>(n);
+}
+
+void MidiPlayback::ChannelStatus::UnlinkKey(int n)
+{
+	Voice& voice = voices[n];
+	if (!voice.keyDown)
+		return;
+	voice.keyDown = false;
+	//Voices of the same key are seldom stacked deeper than a few, unless the sustain pedal is held for a long time.
+	int prev = -1;
+	for (int m = keyFirst[voice.key]; m != n; m = voices[m].nextSameKey)
+		prev = m;
+	if (prev < 0)
+		keyFirst[voice.key] = voice.nextSameKey;
+	else
+		voices[prev].nextSameKey = voice.nextSameKey;
+	if (keyLast[voice.key] == n)
+		keyLast[voice.key] = static_cast<int8_t>(prev);
+}
+
+void MidiPlayback::ChannelStatus::RebuildKeyIndex()
+{
+	std::fill(std::begin(keyFirst), std::end(keyFirst), static_cast<int8_t>(-1));
+	std::fill(std::begin(keyLast), std::end(keyLast), static_cast<int8_t>(-1));
+	for (int n = 0; n < toneCount; n++)
+	{
+		if (voices[n].keyDown)
+			LinkKey(n);
+	}
+}
+
+void MidiPlayback::ChannelStatus::StealVoice(int n, int fadeFrames)
+{
+	UnlinkKey(n);
+	voices[n].fadeFrames = fadeFrames;
+	fadingCount++;
+}
+
+//If a voice with level, priority, releasing and serial should be stolen rather than another one.
+static bool IsPreferredVictim(VoiceStealPolicy policy, SampleType aLevel, int aPriority, bool aReleasing, size_t aSerial,
+	SampleType bLevel, int bPriority, bool bReleasing, size_t bSerial)
+{
+	if (policy == VoiceStealPolicy::Quietest && aLevel != bLevel)
+		return aLevel < bLevel;
+	if (policy == VoiceStealPolicy::LowestPriority && aPriority != bPriority)
+		return aPriority < bPriority;
+	if (policy != VoiceStealPolicy::Quietest && aReleasing != bReleasing)
+		return aReleasing;
+	return aSerial < bSerial;
+}
+
+void MidiPlayback::ChannelStatus::UpdateVictim(VoiceStealPolicy policy)
+{
+	//The voices of a channel share its priority.
+	victim = -1;
+	for (int n = 0; n < toneCount; n++)
+	{
+		const Voice& voice = voices[n];
+		if (voice.IsStolen())
+			continue;
+		if (victim < 0 || IsPreferredVictim(policy, voice.level, 0, voice.tone->IsReleasing(), voice.serial,
+			voices[victim].level, 0, voices[victim].tone->IsReleasing(), voices[victim].serial))
+			victim = n;
+	}
+	victimStamp++;
+}
+
+void MidiPlayback::ChannelStatus::MixVoice(int n, SampleType* left, SampleType* right, SampleType* outLeft, SampleType* outRight, size_t frames, bool& playing)
+{
+	Voice& voice = voices[n];
+	if (voice.IsStolen())
+	{
+		SampleType fadeStep = static_cast<SampleType>(1.0 / STEAL_FADE_FRAMES);
+		SampleType fade = voice.fadeFrames * fadeStep;
+		for (size_t i = 0; i < frames; i++)
 		{
-			Tone*& p = pTones[n];
-			if (p)
-			{
-				p->PitchBend(value, pitchBendDepth);
-				break;
-			}
+			fade = fade > fadeStep ? fade - fadeStep : 0;
+			left[i] *= fade;
+			right[i] *= fade;
 		}
+		voice.fadeFrames = std::max(voice.fadeFrames - static_cast<int>(frames), 0);
+		if (voice.fadeFrames == 0)
+			playing = false;
+	}
+
+	double volumeRatio = static_cast<double>(volume) / 127.0;
+	double expressionRatio = static_cast<double>(expression) / 127.0;
+	double panPos = static_cast<double>(pan) / 128.0;
+	if (percussionBank >= 0)
+	{
+		int pitchIdx = static_cast<int>(voice.tone->GetPitch());
+		panPos = (panPos + (drumPan[pitchIdx] / 128.0)) / 2;
 	}
+	SampleType gainLeft = static_cast<SampleType>(volumeRatio * expressionRatio * (1 - panPos));
+	SampleType gainRight = static_cast<SampleType>(volumeRatio * expressionRatio * panPos);
+	SampleType level = 0;
+	for (size_t i = 0; i < frames; i++)
+	{
+		SampleType voiceLeft = left[i] * gainLeft;
+		SampleType voiceRight = right[i] * gainRight;
+		outLeft[i] += voiceLeft;
+		outRight[i] += voiceRight;
+		level = std::max(level, std::abs(voiceLeft) + std::abs(voiceRight));
+	}
+	if (frames > 0)
+		voice.level = level;
+}
+
+void MidiPlayback::ChannelStatus::MixBatch(SampleType* outLeft, SampleType* outRight, size_t frames, bool* playing)
+{
+	if (batchLanes == 0)
+		return;
+	voiceBatch.Render(batchLanes, frames);
+	for (int lane = 0; lane < batchLanes; lane++)
+		MixVoice(batchVoices[lane], voiceBatch.left[lane], voiceBatch.right[lane], outLeft, outRight, frames, playing[batchVoices[lane]]);
+	batchLanes = 0;
 }
 
-void MidiPlayback::ChannelStatus::TriggerPulse(double& outLeft, double& outRight)
+void MidiPlayback::ChannelStatus::RenderBlock(SampleType* outLeft, SampleType* outRight, size_t frames)
 {
-	double left{ 0 };
-	double right{ 0 };
-	double leftTotal{ 0 };
-	double rightTotal{ 0 };
-	for (int n = 0; n < MAX_POLYPHONICS; n++)
+	for (size_t i = 0; i < frames; i++)
+		outLeft[i] = outRight[i] = 0;
+
+	if (sustainChanged || modulationChanged || pitchBendChanged || cutOffChanged || resonanceChanged)
+		PushParams(frames);
+
+	//The sample voices are rendered VOICE_BATCH_LANES at a time. The batch is mixed before any other voice, so that
+	//the voices are still mixed from the oldest to the newest.
+	voiceCount = 0;
+	bool playing[MAX_POLYPHONICS];
+	for (int n = 0; n < toneCount; n++)
 	{
-		if (pTones[n])
+		Voice& voice = voices[n];
+		playing[n] = false;
+		if (voice.fadeFrames == 0)	//Stolen and cut.
+			continue;
+		voiceCount++;
+		if (voice.tone->PrepareVoice(voiceBatch, batchLanes, frames, playing[n]))
 		{
-			pTones[n]->SetSustain(sustain);
-			pTones[n]->SetModulation(modulationDepth, modulationSpeed);
-			if (pTones[n]->TriggerPulse(left, right))
-			{
-				double vol = static_cast<double>(volume) / 127.0;
-				double expr = static_cast<double>(expression) / 127.0;
-				double panPos = static_cast<double>(pan) / 128.0;
-				if (percussionBank >= 0)
-				{
-					int pitchIdx = static_cast<int>(pTones[n]->GetPitch());
-					panPos = (panPos + (drumPan[pitchIdx] / 128.0)) / 2;
-				}
-				leftTotal += left * vol * expr * (1 - panPos);
-				rightTotal += right * vol * expr * panPos;
-			}
-			else
-			{
-				delete pTones[n];
-				int m;
-				for (m = n; m < MAX_POLYPHONICS - 1 && pTones[m + 1] != nullptr; m++)
-					pTones[m] = pTones[m + 1];
-				pTones[m] = nullptr;
-				n--;
-			}
+			batchVoices[batchLanes++] = n;
+			if (batchLanes == VOICE_BATCH_LANES)
+				MixBatch(outLeft, outRight, frames, playing);
+			continue;
 		}
+		MixBatch(outLeft, outRight, frames, playing);
+		playing[n] = voice.tone->RenderBlock(toneLeft, toneRight, frames);
+		MixVoice(n, toneLeft, toneRight, outLeft, outRight, frames, playing[n]);
+	}
+	MixBatch(outLeft, outRight, frames, playing);
+
+	//The tones that have ended are removed: the playing ones are moved down over them, keeping their order.
+	int kept = 0;
+	for (int n = 0; n < toneCount; n++)
+	{
+		if (playing[n])
+			voices[kept++] = voices[n];
 		else
-			break;
+		{
+			if (voices[n].IsStolen())
+				fadingCount--;
+			voicePool.Destroy(voices[n].tone);
+		}
+	}
+	for (int n = kept; n < toneCount; n++)
+		voices[n].tone = nullptr;
+	if (kept != toneCount)
+	{
+		toneCount = kept;
+		RebuildKeyIndex();
 	}
 
+	for (size_t i = 0; i < frames; i++)
+	{
 #if (!USE_GLOBAL_EFFECT_PROCESSOR)
-	chorusProcessor.TriggerPulse(leftTotal, rightTotal, leftTotal, rightTotal);
-	echoProcessor.TriggerPulse(leftTotal, rightTotal, leftTotal, rightTotal);
-	reverbProcessor.TriggerPulse(leftTotal, rightTotal, leftTotal, rightTotal);
+		chorusProcessor.TriggerPulse(outLeft[i], outRight[i], outLeft[i], outRight[i]);
+		echoProcessor.TriggerPulse(outLeft[i], outRight[i], outLeft[i], outRight[i]);
+		reverbProcessor.TriggerPulse(outLeft[i], outRight[i], outLeft[i], outRight[i]);
 #endif
-
-	outLeft = leftTotal;
-	outRight = rightTotal;
 #if (TRACE_PEAK)
-	peakPulseCounter++;
-	if (peakPulseCounter > SAMPLE_RATE / 100)
-	{
-		peakWritePos = (peakWritePos + 1) % 10;
-		peakPulseCounter = 0;
-	}
-	int vol = static_cast<int>((std::abs(outLeft) + std::abs(outRight)) / 327.68 / 2);
-	peaksFIFO[peakWritePos] = std::max(peaksFIFO[peakWritePos], vol);
+		peakPulseCounter++;
+		if (peakPulseCounter > SAMPLE_RATE / 100)
+		{
+			peakWritePos = (peakWritePos + 1) % 10;
+			peakPulseCounter = 0;
+		}
+		int vol = static_cast<int>((std::abs(outLeft[i]) + std::abs(outRight[i])) / 327.68 / 2);
+		peaksFIFO[peakWritePos] = std::max(peaksFIFO[peakWritePos], vol);
 #endif
+	}
 }
 
 
@@ -268,6 +455,7 @@ MidiPlayback::~MidiPlayback()
 
 void MidiPlayback::LoadMidiFile(std::string fileName)
 {
+	//Give the tones of the last file back to their pools.
 	Rewind();
 
 	midiData.LoadMidiFile(fileName);
@@ -275,9 +463,18 @@ void MidiPlayback::LoadMidiFile(std::string fileName)
 	tracksStatus.clear();
 	for (size_t i = 0; i < midiData.tracks.size(); i++)
 	{
-		TrackStatus tpb{};
-		tracksStatus.push_back(tpb);
+		tracksStatus.emplace_back();
+		//Tones of a channel are created in its own pool, so that channels rendered in parallel share nothing.
+		for (int ch = 0; ch < MAX_MIDI_CHANNELS; ch++)
+		{
+			if (midiData.tracks[i].channels[ch].size() > 0)
+				tracksStatus[i].channels[ch].voicePool.Reserve(MAX_POLYPHONICS);
+		}
 	}
+	//Reset the new tracks, drum pans are not initialized until then.
+	Rewind();
+
+	activeChannels.reserve(tracksStatus.size() * MAX_MIDI_CHANNELS);
 
 	WaveformTone::FreeWaveforms();
 	//Scan the midi events and get program events, 
@@ -299,194 +496,470 @@ void MidiPlayback::LoadMidiFile(std::string fileName)
 	WaveformTone::LoadWaveform(512, 0);
 	//Load at lease the piano
 	WaveformTone::LoadWaveform(0, 0);
+
+	BuildTimeline();
+
+	//Between two blocks the victims of the channels are pushed again by the events of one frame: twice by a note on that
+	//steals a voice, once by a note off.
+	size_t channels = 0;
+	for (auto& track : midiData.tracks)
+	{
+		for (auto& channel : track.channels)
+			channels += channel.size() > 0;
+	}
+	size_t burst = 0;
+	for (size_t n = 0, first = 0; n < timeline.size(); n++)
+	{
+		if (timeline[n].frame != timeline[first].frame)
+			first = n;
+		burst = std::max(burst, n - first + 1);
+	}
+	victims.reserve(channels + 2 * burst);
 }
 
-bool MidiPlayback::PrepareBuffer(char* pBuffer, size_t bufferSize)
+void MidiPlayback::BuildTimeline()
 {
-#if (TRACE_PROCESS_TIME)
-	auto timeNow = std::chrono::system_clock::now();
-#endif
-	int silentPulseCount = 0;
+	timeline.clear();
+	for (size_t t = 0; t < midiData.tracks.size(); t++)
+	{
+		for (uint8_t ch = 0; ch < MAX_MIDI_CHANNELS; ch++)
+		{
+			for (auto& evt : midiData.tracks[t].channels[ch])
+				timeline.push_back({ 0, static_cast<uint16_t>(t), ch, &evt });
+		}
+	}
+	//Events at the same tick keep the order of track, channel and position in the channel.
+	std::stable_sort(timeline.begin(), timeline.end(), [](const TimelineEvent& a, const TimelineEvent& b) {
+		return a.event->timeTicks < b.event->timeTicks;
+	});
 
-	for (size_t i = 0; i < bufferSize; i += 4)
+	//Walk through the tempo map. A tick starts at the first frame whose time reaches it.
+	double samplesPerMidiTick = 183.75 / 3;
+	size_t tempoTick = 0;
+	size_t tempoFrame = 0;
+	for (auto& item : timeline)
 	{
-		midiTick = static_cast<int>(currentSampleIdx / samplesPerMidiTick);
-		currentSampleIdx++;
+		const MidiEvent& evt = *item.event;
+		double ticks = static_cast<double>(evt.timeTicks - tempoTick);
+		double frames = std::ceil(ticks * samplesPerMidiTick);
+		while (frames > 0 && (frames - 1) / samplesPerMidiTick >= ticks)
+			frames--;
+		while (frames / samplesPerMidiTick < ticks)
+			frames++;
+		item.frame = tempoFrame + static_cast<size_t>(frames);
 
-		//If it's a new midi tick
-		if (midiTick != lastMidiTick)
+		if (evt.event == E_NonMidi && evt.params[0] == M_PlaybackSpeed)
 		{
-			lastMidiTick = midiTick;
+			samplesPerMidiTick = 0;
+			for (int co = 0; co < evt.params[1]; co++)
+			{
+				samplesPerMidiTick *= 256;
+				samplesPerMidiTick += evt.params[2 + co];
+			}
+			samplesPerMidiTick = samplesPerMidiTick * SAMPLE_RATE / 1000000 / midiData.header.timeBase;
+			tempoTick = evt.timeTicks;
+			tempoFrame = item.frame;
+		}
+	}
+}
 
-			//Get each event from midi data
-			for (size_t t = 0; t < midiData.tracks.size(); t++)
+void MidiPlayback::ParseEvent(const TimelineEvent& item)
+{
+	const MidiEvent& evt = *item.event;
+	ChannelStatus& channel = tracksStatus[item.track].channels[item.channel];
+	if (evt.event == E_NoteOn && evt.params[1] > 0)
+	{
+		int toneCount = channel.toneCount;
+		if (toneCount >= MAX_POLYPHONICS)
+			droppedNotes++;
+		channel.ParseEvent(evt.event, evt.params, printMessages);
+		//The voice is stolen only after the new tone has been created, so that none is stolen for a note that makes no tone.
+		if (channel.toneCount > toneCount)
+		{
+			channel.voices[toneCount].serial = noteSerial++;
+			liveVoices++;
+			if (maxVoices > 0)
 			{
-				for (uint8_t ch = 0; ch < MAX_MIDI_CHANNELS; ch++)
-				{
-					if (midiData.tracks[t].channels[ch].size() == 0)
-						continue;	//Don't bother to process an empty channel.
-
-					auto& events = midiData.tracks[t].channels[ch];
-					auto& currentEventIdx = tracksStatus[t].channels[ch].currentEventIdx;
-					//If current midi tick is the event's expected tick...
-					while (currentEventIdx < events.size() && events[currentEventIdx].timeTicks == midiTick)
-					{
-						//Parse the event
-						tracksStatus[t].channels[ch].ParseEvent(events[currentEventIdx].event, events[currentEventIdx].params);
-						if (events[currentEventIdx].event == E_SystemCode)
-						{
-/*							std::cout << " S ";
-							for (auto& item : events[currentEventIdx].params)
-							{
-								std::cout << (int)item << " ";
-							}
-							std::cout << std::endl;
-*/
-							//07 7f 7f 04 01 00 xx f7 means master volume change.
-							//I don't know why.
-							if (events[currentEventIdx].params[0] == 7 && events[currentEventIdx].params[1] == 0x7f && events[currentEventIdx].params[2] == 0x7f)
-							{
-								if (events[currentEventIdx].params[3] == 4 && events[currentEventIdx].params[4] == 1 && events[currentEventIdx].params[5] == 0)
-									masterVolume = static_cast<double>(events[currentEventIdx].params[6]) / 127.;
-							}
-						}
-						else if (events[currentEventIdx].event == E_NonMidi)
-						{
-							switch (events[currentEventIdx].params[0])
-							{
-							case M_Text:
-							case M_CopyRight:
-							case M_TrackName:
-							case M_InstrumentName:
-							case M_Lyrics:
-							case M_Mark:
-							case M_Remark:
-								for (int n = 0; n < events[currentEventIdx].params[1]; n++)
-								{
-									std::cout << events[currentEventIdx].params[2 + n];
-								}
-								std::cout << std::endl;
-								break;
-							case M_EndOfTrack:
-								tracksStatus[t].trackEnd = true;
-								break;
-							case M_PlaybackSpeed:
-								samplesPerMidiTick = 0;
-								for (int co = 0; co < events[currentEventIdx].params[1]; co++)
-								{
-									samplesPerMidiTick *= 256;
-									samplesPerMidiTick += events[currentEventIdx].params[2 + co];
-								}
-								samplesPerMidiTick = samplesPerMidiTick * SAMPLE_RATE / 1000000 / midiData.header.timeBase;
-								//Recalibrate currentSampleIdx when speed changed during playing back
-								currentSampleIdx = midiTick * samplesPerMidiTick + 1;
-							}
-						}
-						currentEventIdx++;
-					}
-				}
+				//A new voice is never preferred to the voices that are already there.
+				if (channel.victim < 0)
+					PushVictim(channel);
+				if (liveVoices > maxVoices)
+					StealVoice();
 			}
 		}
+	}
+	else
+	{
+		channel.ParseEvent(evt.event, evt.params, printMessages);
+		//A released voice may be stolen first now.
+		if (maxVoices > 0 && stealPolicy != VoiceStealPolicy::Quietest && (evt.event == E_NoteOn || evt.event == E_NoteOff))
+			PushVictim(channel);
+	}
+	channel.currentEventIdx++;
 
-		double leftTotal{ 0 }, rightTotal{ 0 };
-		double left{ 0 }, right{ 0 };
-		int16_t vLeft{ 0 }, vRight{ 0 };
-		double inChorusL{ 0 }, inChorusR{ 0 };
-		double inEchoL{ 0 }, inEchoR{ 0 };
-		double inReverbL{ 0 }, inReverbR{ 0 };
-		double outChorusL{ 0 }, outChorusR{ 0 };
-		double outEchoL{ 0 }, outEchoR{ 0 };
-		double outReverbL{ 0 }, outReverbR{ 0 };
-
-		for (auto& track : tracksStatus)
+	if (evt.event == E_SystemCode)
+	{
+/*		std::cout << " S ";
+		for (auto& param : evt.params)
 		{
-			for (auto& chn : track.channels)
+			std::cout << (int)param << " ";
+		}
+		std::cout << std::endl;
+*/
+		//07 7f 7f 04 01 00 xx f7 means master volume change.
+		//I don't know why.
+		if (evt.params[0] == 7 && evt.params[1] == 0x7f && evt.params[2] == 0x7f)
+		{
+			if (evt.params[3] == 4 && evt.params[4] == 1 && evt.params[5] == 0)
+				masterVolume = static_cast<double>(evt.params[6]) / 127.;
+		}
+	}
+	else if (evt.event == E_NonMidi)
+	{
+		switch (evt.params[0])
+		{
+		case M_Text:
+		case M_CopyRight:
+		case M_TrackName:
+		case M_InstrumentName:
+		case M_Lyrics:
+		case M_Mark:
+		case M_Remark:
+			if (!printMessages)
+				break;
+			for (int n = 0; n < evt.params[1]; n++)
 			{
-				if (!chn.IsInUse())
-					continue;
-				chn.TriggerPulse(left, right);
+				std::cout << evt.params[2 + n];
+			}
+			std::cout << std::endl;
+			break;
+		case M_EndOfTrack:
+			tracksStatus[item.track].trackEnd = true;
+			break;
+		case M_PlaybackSpeed:
+			//Already applied to the frames of the timeline.
+			break;
+		}
+	}
+}
+
+bool MidiPlayback::IsLaterVictim(const VictimEntry& a, const VictimEntry& b) const
+{
+	return IsPreferredVictim(stealPolicy, b.level, b.priority, b.releasing, b.serial, a.level, a.priority, a.releasing, a.serial);
+}
+
+void MidiPlayback::PushVictim(ChannelStatus& channel)
+{
+	channel.UpdateVictim(stealPolicy);
+	if (channel.victim < 0)
+		return;
+	auto later = [this](const VictimEntry& a, const VictimEntry& b) { return IsLaterVictim(a, b); };
+	if (victims.size() == victims.capacity())
+	{
+		victims.erase(std::remove_if(victims.begin(), victims.end(), [](const VictimEntry& entry) { return entry.stamp != entry.channel->victimStamp; }), victims.end());
+		std::make_heap(victims.begin(), victims.end(), later);
+	}
+	const ChannelStatus::Voice& voice = channel.voices[channel.victim];
+	victims.push_back({ voice.level, channelPriority[channel.number], voice.tone->IsReleasing(), voice.serial, &channel, channel.victimStamp });
+	std::push_heap(victims.begin(), victims.end(), later);
+}
+
+void MidiPlayback::BuildVictims()
+{
+	victims.clear();
+	if (maxVoices <= 0)
+		return;
+	for (ChannelStatus* chn : activeChannels)
+		PushVictim(*chn);
+}
+
+void MidiPlayback::StealVoice()
+{
+	auto later = [this](const VictimEntry& a, const VictimEntry& b) { return IsLaterVictim(a, b); };
+	//Skip the entries of channels whose victim has been chosen again since.
+	//The new voice is on top only if its channel has the lowest priority and no other voice, it is put back after the steal.
+	bool spared = false;
+	VictimEntry newVoice{};
+	while (!victims.empty() && (victims.front().stamp != victims.front().channel->victimStamp || victims.front().serial == noteSerial - 1))
+	{
+		if (victims.front().serial == noteSerial - 1 && victims.front().stamp == victims.front().channel->victimStamp)
+		{
+			spared = true;
+			newVoice = victims.front();
+		}
+		std::pop_heap(victims.begin(), victims.end(), later);
+		victims.pop_back();
+	}
+	if (victims.empty())
+	{
+		//Only the new voice is left.
+		if (spared)
+			victims.push_back(newVoice);
+		return;
+	}
+	ChannelStatus& channel = *victims.front().channel;
+	std::pop_heap(victims.begin(), victims.end(), later);
+	victims.pop_back();
+	if (spared)
+	{
+		victims.push_back(newVoice);
+		std::push_heap(victims.begin(), victims.end(), later);
+	}
+
+	//A burst of note ons could keep lots of voices fading. Beyond a quarter of the limit, stolen voices are cut at once.
+	channel.StealVoice(channel.victim, fadingVoices < std::max(maxVoices / 4, 1) ? STEAL_FADE_FRAMES : 0);
+	liveVoices--;
+	fadingVoices++;
+	stolenNotes++;
+	PushVictim(channel);
+}
+
+//Job of the render thread pool.
+struct RenderChannelsJob
+{
+	MidiPlayback::ChannelStatus** channels;
+	size_t frames;
+
+	static void Render(void* context, size_t index)
+	{
+		RenderChannelsJob* job = static_cast<RenderChannelsJob*>(context);
+		MidiPlayback::ChannelStatus* chn = job->channels[index];
+		chn->RenderBlock(chn->blockLeft, chn->blockRight, job->frames);
+	}
+};
+
+void MidiPlayback::MixBlock(size_t frames)
+{
+	for (size_t i = 0; i < frames; i++)
+	{
+		mixLeft[i] = mixRight[i] = 0;
 #if (USE_GLOBAL_EFFECT_PROCESSOR)
-				inChorusL += left * chn.chorusDepth / 127.0;
-				inChorusR += right * chn.chorusDepth / 127.0;
-				inEchoL += left * (chn.echoDepth / 158.75 + 0.2 * (chn.echoDepth > 0));
-				inEchoR += right * (chn.echoDepth / 158.75 + 0.2 * (chn.echoDepth > 0));
+		chorusLeft[i] = chorusRight[i] = 0;
+		echoLeft[i] = echoRight[i] = 0;
+		reverbLeft[i] = reverbRight[i] = 0;
+#endif
+	}
 
-				//For a percussion channel, reverb level should be reduced to avoid noise. I reckon it should be 40%.
-				if (chn.percussionBank >= 0)
-				{
-					inReverbL += left * chn.reverbDepth / 127.0 * 0.4;
-					inReverbR += right * chn.reverbDepth / 127.0 * 0.4;
-				}
-				else
-				{
-					inReverbL += left * chn.reverbDepth / 127.0;
-					inReverbR += right * chn.reverbDepth / 127.0;
-				}
+	activeChannels.clear();
+	for (auto& track : tracksStatus)
+	{
+		for (auto& chn : track.channels)
+		{
+			if (chn.IsInUse())
+				activeChannels.push_back(&chn);
+		}
+	}
+
+	//Channels share nothing until they are summed, so they can be rendered in any order.
+	RenderChannelsJob job{ activeChannels.data(), frames };
+	if (threadPool && activeChannels.size() > 1)
+		threadPool->Run(activeChannels.size(), RenderChannelsJob::Render, &job);
+	else
+	{
+		for (size_t n = 0; n < activeChannels.size(); n++)
+			RenderChannelsJob::Render(&job, n);
+	}
+
+	int voices = 0;
+	liveVoices = 0;
+	fadingVoices = 0;
+	for (ChannelStatus* chn : activeChannels)
+	{
+		voices += chn->voiceCount;
+		liveVoices += chn->toneCount - chn->fadingCount;
+		fadingVoices += chn->fadingCount;
+		const SampleType* channelLeft = chn->blockLeft;
+		const SampleType* channelRight = chn->blockRight;
+#if (USE_GLOBAL_EFFECT_PROCESSOR)
+		SampleType chorusSend = static_cast<SampleType>(chn->chorusDepth / 127.0);
+		SampleType echoSend = static_cast<SampleType>(chn->echoDepth / 158.75 + 0.2 * (chn->echoDepth > 0));
+		//For a percussion channel, reverb level should be reduced to avoid noise. I reckon it should be 40%.
+		SampleType reverbSend = static_cast<SampleType>(chn->reverbDepth / 127.0 * (chn->percussionBank >= 0 ? 0.4 : 1));
+		for (size_t i = 0; i < frames; i++)
+		{
+			chorusLeft[i] += channelLeft[i] * chorusSend;
+			chorusRight[i] += channelRight[i] * chorusSend;
+			echoLeft[i] += channelLeft[i] * echoSend;
+			echoRight[i] += channelRight[i] * echoSend;
+			reverbLeft[i] += channelLeft[i] * reverbSend;
+			reverbRight[i] += channelRight[i] * reverbSend;
+		}
 #endif
-				leftTotal += left;
-				rightTotal += right;
-			}		
+		for (size_t i = 0; i < frames; i++)
+		{
+			mixLeft[i] += channelLeft[i];
+			mixRight[i] += channelRight[i];
 		}
+	}
+	peakVoices = std::max(peakVoices, voices);
+	//The levels and the voices have changed.
+	BuildVictims();
+}
+
+size_t MidiPlayback::RenderMasterBlock(size_t maxFrames)
+{
+	while (timelineIdx < timeline.size() && timeline[timelineIdx].frame <= currentFrame)
+		ParseEvent(timeline[timelineIdx++]);
+
+	//A block never crosses an event, so that events are parsed at their exact frames.
+	size_t frames = std::min(maxFrames, RENDER_BLOCK_SIZE);
+	if (timelineIdx < timeline.size())
+		frames = std::min(frames, timeline[timelineIdx].frame - currentFrame);
+	currentFrame += frames;
+	MixBlock(frames);
+
+	SampleType volume = static_cast<SampleType>(masterVolume);
+	for (size_t n = 0; n < frames; n++)
+	{
+		SampleType leftTotal = mixLeft[n];
+		SampleType rightTotal = mixRight[n];
 #if (USE_GLOBAL_EFFECT_PROCESSOR)
+		SampleType outChorusL{ 0 }, outChorusR{ 0 };
+		SampleType outEchoL{ 0 }, outEchoR{ 0 };
+		SampleType outReverbL{ 0 }, outReverbR{ 0 };
+
 		//Effects
-		chorusProcessor.TriggerPulse(inChorusL, inChorusR, outChorusL, outChorusR);
+		chorusProcessor.TriggerPulse(chorusLeft[n], chorusRight[n], outChorusL, outChorusR);
 		leftTotal += outChorusL;
 		rightTotal += outChorusR;
-		echoProcessor.TriggerPulse(inEchoL, inEchoR, outEchoL, outEchoR);
+		echoProcessor.TriggerPulse(echoLeft[n], echoRight[n], outEchoL, outEchoR);
 		leftTotal += outEchoL;
 		rightTotal += outEchoR;
-		reverbProcessor.TriggerPulse(inReverbL + outEchoL * 0.4, inReverbR + outEchoR * 0.4, outReverbL, outReverbR);
+		reverbProcessor.TriggerPulse(reverbLeft[n] + outEchoL * static_cast<SampleType>(0.4), reverbRight[n] + outEchoR * static_cast<SampleType>(0.4), outReverbL, outReverbR);
 		leftTotal += outReverbL;
 		rightTotal += outReverbR;
 #endif
 		//main volume
-		leftTotal *= masterVolume;
-		rightTotal *= masterVolume;
+		masterLeft[n] = leftTotal * volume;
+		masterRight[n] = rightTotal * volume;
+	}
+	return frames;
+}
+
+bool MidiPlayback::IsPlaybackDone(int silentPulseCount)
+{
+	bool eof = true;
+	for (size_t i = 0; i < midiData.tracks.size(); i++)
+	{
+		eof &= tracksStatus[i].trackEnd;
+	}
+	return eof && silentPulseCount > 50;
+}
 
-		vLeft = leftTotal > 32767 ? 32767 : (leftTotal < -32768 ? -32768 : static_cast<int16_t>(leftTotal));
-		vRight = rightTotal > 32767 ? 32767 : (rightTotal < -32768 ? -32768 : static_cast<int16_t>(rightTotal));
 #if (TRACE_PEAK)
-		peakPulseCounter++;
-		if (peakPulseCounter > SAMPLE_RATE / 100)
+void MidiPlayback::TracePeak(int16_t vLeft, int16_t vRight)
+{
+	peakPulseCounter++;
+	if (peakPulseCounter > SAMPLE_RATE / 100)
+	{
+		peakWritePos = (peakWritePos + 1) % 10;
+		peakPulseCounter = 0;
+	}
+	peaksLeftFIFO[peakWritePos] = peaksLeftFIFO[peakWritePos] > vLeft ? peaksLeftFIFO[peakWritePos] : vLeft;
+	peaksRightFIFO[peakWritePos] = peaksRightFIFO[peakWritePos] > vRight ? peaksLeftFIFO[peakWritePos] : vRight;
+}
+#endif
+
+static inline int16_t ClampToInt16(SampleType v)
+{
+	return v > 32767 ? 32767 : (v < -32768 ? -32768 : static_cast<int16_t>(v));
+}
+
+void MidiPlayback::SetRenderThreads(int threads)
+{
+	if (threads <= 1)
+		threadPool.reset();
+	else if (GetRenderThreads() != threads)
+		threadPool.reset(new RenderThreadPool(threads));
+}
+
+bool MidiPlayback::PrepareBuffer(char* pBuffer, size_t bufferSize)
+{
+#if (TRACE_PROCESS_TIME)
+	auto timeNow = std::chrono::system_clock::now();
+#endif
+	int silentPulseCount = 0;
+
+	size_t i = 0;
+	while (i + 4 <= bufferSize)
+	{
+		size_t frames = RenderMasterBlock((bufferSize - i) / 4);
+		for (size_t n = 0; n < frames; n++, i += 4)
 		{
-			peakWritePos = (peakWritePos + 1) % 10;
-			peakPulseCounter = 0;
-		}
-		peaksLeftFIFO[peakWritePos] = peaksLeftFIFO[peakWritePos] > vLeft ? peaksLeftFIFO[peakWritePos] : vLeft;
-		peaksRightFIFO[peakWritePos] = peaksRightFIFO[peakWritePos] > vRight ? peaksLeftFIFO[peakWritePos] : vRight;
+			int16_t vLeft = ClampToInt16(masterLeft[n]);
+			int16_t vRight = ClampToInt16(masterRight[n]);
+#if (TRACE_PEAK)
+			TracePeak(vLeft, vRight);
 #endif
-		pBuffer[i + 0] = (vLeft & 0xff);
-		pBuffer[i + 1] = (vLeft >> 8);
-		pBuffer[i + 2] = (vRight & 0xff);
-		pBuffer[i + 3] = (vRight >> 8);
+			pBuffer[i + 0] = (vLeft & 0xff);
+			pBuffer[i + 1] = (vLeft >> 8);
+			pBuffer[i + 2] = (vRight & 0xff);
+			pBuffer[i + 3] = (vRight >> 8);
 
-		if (vLeft + vRight == 0)
-			silentPulseCount++;
-		else
-			silentPulseCount = 0;
+			if (vLeft + vRight == 0)
+				silentPulseCount++;
+			else
+				silentPulseCount = 0;
+		}
 	}
 
-	bool eof = true;
-	for (size_t i = 0; i < midiData.tracks.size(); i++)
+#if (TRACE_PROCESS_TIME)
+	auto span = std::chrono::system_clock::now() - timeNow;
+	cpuPercentage = std::chrono::duration<double>(span).count() / (bufferSize / 4 / SAMPLE_RATE);
+#endif
+
+	return !IsPlaybackDone(silentPulseCount);
+}
+
+bool MidiPlayback::PrepareBuffer(float* pLeft, float* pRight, size_t frames)
+{
+#if (TRACE_PROCESS_TIME)
+	auto timeNow = std::chrono::system_clock::now();
+#endif
+	int silentPulseCount = 0;
+
+	size_t i = 0;
+	while (i < frames)
 	{
-		eof &= tracksStatus[i].trackEnd;
+		size_t blockFrames = RenderMasterBlock(frames - i);
+		for (size_t n = 0; n < blockFrames; n++, i++)
+		{
+			//Not clipped. Silence and peaks are measured as they are in the 16bit output.
+			pLeft[i] = static_cast<float>(masterLeft[n] * (1 / static_cast<SampleType>(32768)));
+			pRight[i] = static_cast<float>(masterRight[n] * (1 / static_cast<SampleType>(32768)));
+
+			int16_t vLeft = ClampToInt16(masterLeft[n]);
+			int16_t vRight = ClampToInt16(masterRight[n]);
+#if (TRACE_PEAK)
+			TracePeak(vLeft, vRight);
+#endif
+			if (vLeft + vRight == 0)
+				silentPulseCount++;
+			else
+				silentPulseCount = 0;
+		}
 	}
 
 #if (TRACE_PROCESS_TIME)
 	auto span = std::chrono::system_clock::now() - timeNow;
-	cpuPercentage = (std::chrono::duration_cast<std::chrono::milliseconds>(span)).count() / (bufferSize / SAMPLE_RATE * 250);
+	cpuPercentage = std::chrono::duration<double>(span).count() / (frames / SAMPLE_RATE);
 #endif
 
-	return !(eof && silentPulseCount > 50);
+	return !IsPlaybackDone(silentPulseCount);
 }
 
 void MidiPlayback::Rewind()
 {
 	//Reset all status for the next playback.
-	currentSampleIdx = 0;
-	midiTick = 0;
-	lastMidiTick = -1;
-	samplesPerMidiTick = 183.75 / 3 ;
+	currentFrame = 0;
+	timelineIdx = 0;
+	peakVoices = 0;
+	stolenNotes = 0;
+	droppedNotes = 0;
+	noteSerial = 0;
+	liveVoices = 0;
+	fadingVoices = 0;
+	victims.clear();
 	masterVolume = 1.;
 	peakReadPos = 6;
 	peakWritePos = 0;
@@ -23,12 +23,27 @@
 #include "chorus.h"
 #include "echo.h"
 #include "reverb.h"
+#include "RenderThreadPool.h"
+#include "VoicePool.h"
+#include "VoiceBatch.h"
 
 #define TRACE_PROCESS_TIME true
 #define TRACE_PEAK true
 #define USE_GLOBAL_EFFECT_PROCESSOR true	//If set false, every channel has its independent reverb, chorus and echo processors.
+#define SMOOTH_FILTER_CUTOFF true	//Glide the cut off frequency of the sounding voices to a new value instead of jumping to it.
 
 constexpr int MAX_POLYPHONICS = 64;	//max polyphonics per channel.
+constexpr size_t RENDER_BLOCK_SIZE = 64;	//max frames rendered in one block. Blocks are also split at midi events.
+constexpr double CUTOFF_GLIDE_FRAMES = 512;	//Time constant of the cut off glide in frames, about 12ms.
+constexpr int STEAL_FADE_FRAMES = 256;	//Fade out time of a stolen voice, about 6ms.
+
+//Which voice is stolen when the voice limit of MidiPlayback is reached.
+enum class VoiceStealPolicy
+{
+	OldestReleased,	//The oldest voice whose key has been released, or the oldest voice if no key has been released.
+	Quietest,		//The voice with the lowest level in the last block.
+	LowestPriority	//A voice of the channel with the lowest priority, then as OldestReleased.
+};
 
 class MidiPlayback
 {
@@ -48,6 +63,7 @@ public:
 		int modulationDepth{ 0 };
 		int modulationSpeed{ 64 };
 		int pitchBendDepth{ 2 };
+		int pitchBend{ 8192 };		//The pitch bend wheel, 0 to 16383, 8192 in the middle.
 
 		int lastPitch{ -1 };					//For portamento
 		int portamentoTime{ 0 };
@@ -60,6 +76,16 @@ public:
 		int cutOff{ 0 };
 		int resonance{ 0 };
 
+		//Controllers changed since the last block. The sounding voices get the changes at the start of the next block,
+		//instead of being set every block. New voices get the current values when they are created.
+		bool sustainChanged{ false };
+		bool modulationChanged{ false };
+		bool pitchBendChanged{ false };
+		bool cutOffChanged{ false };
+		bool resonanceChanged{ false };
+		double voiceCutOff{ 0 };	//The cut off frequency of the voices. It glides to cutOff if SMOOTH_FILTER_CUTOFF.
+		void PushParams(size_t frames);
+
 #if (!USE_GLOBAL_EFFECT_PROCESSOR)
 		FxReverb reverbProcessor;
 		FxChorus chorusProcessor;
@@ -106,6 +132,7 @@ public:
 			modulationDepth = 0;
 			modulationSpeed = 64;
 			pitchBendDepth = 2;
+			pitchBend = 8192;
 			lastPitch = -1;
 			portamentoEnable = false;
 			portamentoTime = 0;
@@ -115,15 +142,22 @@ public:
 			peakWritePos = 0;
 			cutOff = 0;
 			resonance = 0;
-
-			for (auto& item : pTones)
+			sustainChanged = false;
+			modulationChanged = false;
+			pitchBendChanged = false;
+			cutOffChanged = false;
+			resonanceChanged = false;
+			voiceCutOff = 0;
+
+			for (int n = 0; n < toneCount; n++)
 			{
-				if (item != nullptr)
-				{
-					delete item;
-					item = nullptr;
-				}
+				voicePool.Destroy(voices[n].tone);
+				voices[n].tone = nullptr;
 			}
+			toneCount = 0;
+			fadingCount = 0;
+			victim = -1;
+			RebuildKeyIndex();
 
 			for (auto& item : drumPan)
 				item = 64;
@@ -164,6 +198,7 @@ public:
 				if (RPNLSB == 0 && RPNMSB == 0)	//Pitch bend sensitivity
 				{
 					pitchBendDepth = data;
+					pitchBendChanged = true;
 				}
 				else if (RPNLSB == 1 && RPNMSB == 0)	//Fine tuning
 				{
@@ -209,6 +244,7 @@ public:
 						break;
 					case 33:	//filter resonance
 						resonance = (dataMSBSave << 7) + data;
+						resonanceChanged = true;
 						break;
 					case 99:	//EG Attack time
 						break;
@@ -237,7 +273,60 @@ public:
 			}
 		}
 
-		Tone* pTones[MAX_POLYPHONICS]{};
+		struct Voice
+		{
+			Tone* tone;
+			size_t serial;		//Order of the note ons of all channels.
+			SampleType level;	//Peak of the last block after the channel gains.
+			int fadeFrames;		//Frames left to fade out if the voice has been stolen, otherwise -1.
+			uint8_t key;
+			bool keyDown;		//Not released or stolen yet. Such voices are chained in the key index.
+			int8_t nextSameKey;	//Next voice in the chain of the key, -1 at the end.
+
+			bool IsStolen() const { return fadeFrames >= 0; }
+		};
+
+		VoicePool voicePool;	//Holds the tones of voices.
+		//The voices playing are voices[0] to voices[toneCount - 1], from the oldest to the newest.
+		Voice voices[MAX_POLYPHONICS]{};
+		int toneCount{ 0 };
+		int fadingCount{ 0 };	//Stolen voices that are still fading out.
+		int voiceCount{ 0 };	//Count of tones rendered in the last block.
+		int number{ 0 };		//Number of this channel in its track.
+		//The voice of this channel that is stolen first under a steal policy, -1 if none. Kept by MidiPlayback while a voice limit is set.
+		int victim{ -1 };
+		unsigned victimStamp{ 0 };	//Increased whenever victim is chosen again.
+		//Choose victim again, over the voices that are not stolen yet.
+		void UpdateVictim(VoiceStealPolicy policy);
+		//Key index. The voices whose key is down are chained by key, from the oldest to the newest, -1 if none.
+		//A note off releases the first voice of the chain.
+		static_assert(MAX_POLYPHONICS <= 127, "Voice indices of the key index are int8_t.");
+		int8_t keyFirst[128];
+		int8_t keyLast[128];
+		//Append voices[n] to the chain of its key.
+		void LinkKey(int n);
+		//Remove voices[n] from the chain of its key.
+		void UnlinkKey(int n);
+		//Chain the voices again after they have been moved.
+		void RebuildKeyIndex();
+		//Fade out voices[n] in fadeFrames frames, or cut it before the next block if fadeFrames is 0.
+		void StealVoice(int n, int fadeFrames);
+		//Block buffers of a single tone.
+		SampleType toneLeft[RENDER_BLOCK_SIZE]{};
+		SampleType toneRight[RENDER_BLOCK_SIZE]{};
+		//The sample voices rendered together, and the voices in its lanes.
+		static_assert(RENDER_BLOCK_SIZE <= VOICE_BATCH_FRAMES, "A block is rendered in one batch.");
+		VoiceBatch voiceBatch;
+		int batchVoices[VOICE_BATCH_LANES]{};
+		int batchLanes{ 0 };
+		//Render the voices in the lanes of the batch, and mix them in order to outLeft and outRight.
+		void MixBatch(SampleType* outLeft, SampleType* outRight, size_t frames, bool* playing);
+		//Fade voices[n] if it is stolen, and mix the block of the voice rendered to left and right. Sets the level of the voice,
+		//and clears playing at the end of the fade.
+		void MixVoice(int n, SampleType* left, SampleType* right, SampleType* outLeft, SampleType* outRight, size_t frames, bool& playing);
+		//Output of this channel in the current block. Aligned so that channels rendered by different threads do not share cache lines.
+		alignas(64) SampleType blockLeft[RENDER_BLOCK_SIZE]{};
+		alignas(64) SampleType blockRight[RENDER_BLOCK_SIZE]{};
 
 #if (TRACE_PEAK)
 		int peaksFIFO[10]{};
@@ -253,8 +342,9 @@ public:
 			return peak;
 		}
 #endif
-		void ParseEvent(const uint8_t& event, const std::vector<uint8_t>& params);
-		void TriggerPulse(double& outLeft, double& outRight);
+		void ParseEvent(const uint8_t& event, const std::vector<uint8_t>& params, bool printMessages);
+		//Render frames of all tones of this channel to outLeft and outRight.
+		void RenderBlock(SampleType* outLeft, SampleType* outRight, size_t frames);
 
 		//If this channel is in use.
 		bool IsInUse()
@@ -272,20 +362,41 @@ public:
 
 		TrackStatus()
 		{
+			for (int ch = 0; ch < MAX_MIDI_CHANNELS; ch++)
+				channels[ch].number = ch;
 			//Channel 9 is defaultly set to percussion channel.
 			channels[9].percussionBank = 0;
 		}
 	};
 	std::vector<TrackStatus> tracksStatus{};
 
-	double currentSampleIdx{ 0 };
-	double samplesPerMidiTick{ 183.75 / 3 };
-	int midiTick{ 0 };
-	int lastMidiTick{ -1 };
+	//An event of the merged timeline of all tracks and channels.
+	struct TimelineEvent
+	{
+		size_t frame;			//Sample frame the event takes effect, through the tempo map.
+		uint16_t track;
+		uint8_t channel;
+		const MidiEvent* event;
+	};
+	std::vector<TimelineEvent> timeline{};
+	size_t timelineIdx{ 0 };	//Next event to be parsed.
+
+	size_t currentFrame{ 0 };
+	int peakVoices{ 0 };		//Max count of tones sounding at the same time since rewound.
+
+	//Voice limit of all channels. 0 = no limit, then only a full channel (MAX_POLYPHONICS) drops notes.
+	//When the limit is reached, a note on steals a voice chosen by stealPolicy. The stolen voice fades out in STEAL_FADE_FRAMES,
+	//it is not counted against the limit while fading. At most a quarter of the limit fade at a time, the other stolen voices are cut.
+	int maxVoices{ 0 };
+	VoiceStealPolicy stealPolicy{ VoiceStealPolicy::OldestReleased };
+	int channelPriority[MAX_MIDI_CHANNELS]{};	//For VoiceStealPolicy::LowestPriority. Voices of a lower priority channel are stolen first.
+	size_t stolenNotes{ 0 };	//Voices stolen since rewound.
+	size_t droppedNotes{ 0 };	//Note ons ignored since rewound, because the channel was full or no voice could be stolen.
 
 	MidiDataCore midiData;
 
 	double masterVolume{ 1.0 };	//change by system code of: 7f 7f 04 01 00 xx (xx = 0 - 7f)
+	bool printMessages{ true };	//Print text events and unsupported controllers to std::cout. Turn it off for realtime playback.
 #if (TRACE_PROCESS_TIME)
 	double cpuPercentage{ 0 };
 #endif
@@ -313,9 +424,71 @@ public:
 	FxReverb reverbProcessor{ true };
 #endif
 
+protected:
+	//Channels in use in the current render block, in the order they are mixed.
+	std::vector<ChannelStatus*> activeChannels;
+	//Renders the channels in parallel. nullptr if rendering in the calling thread only.
+	std::unique_ptr<RenderThreadPool> threadPool;
+
+	//Busses of the current render block.
+	SampleType mixLeft[RENDER_BLOCK_SIZE]{};
+	SampleType mixRight[RENDER_BLOCK_SIZE]{};
+#if (USE_GLOBAL_EFFECT_PROCESSOR)
+	SampleType chorusLeft[RENDER_BLOCK_SIZE]{};
+	SampleType chorusRight[RENDER_BLOCK_SIZE]{};
+	SampleType echoLeft[RENDER_BLOCK_SIZE]{};
+	SampleType echoRight[RENDER_BLOCK_SIZE]{};
+	SampleType reverbLeft[RENDER_BLOCK_SIZE]{};
+	SampleType reverbRight[RENDER_BLOCK_SIZE]{};
+#endif
+	//Final mix after effects and master volume, in 16bit scale.
+	SampleType masterLeft[RENDER_BLOCK_SIZE]{};
+	SampleType masterRight[RENDER_BLOCK_SIZE]{};
+
+	//Merge the events of all tracks and channels to the timeline, sorted by time and stamped with sample frames.
+	void BuildTimeline();
+	//Parse a timeline event.
+	void ParseEvent(const TimelineEvent& item);
+	size_t noteSerial{ 0 };
+	int liveVoices{ 0 };	//Voices of all channels that are not stolen. Counted again after every block.
+	int fadingVoices{ 0 };	//Stolen voices of all channels that are still fading out.
+	//The victims of the channels, as a heap with the voice to be stolen first on top.
+	//It is built again after every block, when the levels and the voices have changed, and a channel pushes its victim again
+	//whenever the victim changes between blocks. Entries of older victims are skipped by their stamps.
+	//Reserved by LoadMidiFile for the pushes of the busiest frame, so that the render path does not allocate. If it is full
+	//all the same, the entries of older victims are removed instead.
+	struct VictimEntry
+	{
+		SampleType level;
+		int priority;
+		bool releasing;
+		size_t serial;
+		ChannelStatus* channel;
+		unsigned stamp;
+	};
+	std::vector<VictimEntry> victims;
+	//If a should be stolen after b, the order of the heap.
+	bool IsLaterVictim(const VictimEntry& a, const VictimEntry& b) const;
+	void PushVictim(ChannelStatus& channel);
+	void BuildVictims();
+	//Steal a voice other than the newest one, after the new voice of a note on has made the voices exceed the limit.
+	void StealVoice();
+	//Render all channels and sum them to the busses.
+	//Channels are summed in a fixed order, so that the result does not depend on the count of threads.
+	void MixBlock(size_t frames);
+	//Parse events, then render up to maxFrames frames to masterLeft and masterRight.
+	//Returns the count of frames rendered.
+	size_t RenderMasterBlock(size_t maxFrames);
+	//All tracks have ended and the output has been silent for a while.
+	bool IsPlaybackDone(int silentPulseCount);
+#if (TRACE_PEAK)
+	void TracePeak(int16_t vLeft, int16_t vRight);
+#endif
+
 public:
 	MidiPlayback()
 	{
+		Tone::InitializeTables();
 #if (USE_GLOBAL_EFFECT_PROCESSOR)
 		chorusProcessor.Start(127);
 		echoProcessor.Start(127);
@@ -326,7 +499,12 @@ public:
 	~MidiPlayback();
 
 	void LoadMidiFile(std::string fileName);
+	//Render channels with threads (including the calling thread). 1 = render in the calling thread only.
+	void SetRenderThreads(int threads);
+	int GetRenderThreads() const { return threadPool ? threadPool->GetThreadCount() : 1; }
 	void Rewind();
 	bool PrepareBuffer(char* pBuffer, size_t bufferSize);
+	//Planar float output, -1.0 to 1.0. pLeft and pRight should have room for frames samples each.
+	bool PrepareBuffer(float* pLeft, float* pRight, size_t frames);
 };
 
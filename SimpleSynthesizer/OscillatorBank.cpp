@@ -0,0 +1,133 @@
+/*
+	SimpleSynthesizer V0.2
+	Oscillator bank for additive tones.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <cstdint>
+#include <cmath>
+#include "Tone.h"
+#include "OscillatorBank.h"
+
+OscillatorBank::Spectrum::Spectrum(const std::vector<Partial>& partials)
+{
+	if (partials.size() > OSCILLATOR_BANK_SIZE)
+		throw 0;
+	count = static_cast<int>(partials.size());
+	groups = (count + OSCILLATOR_LANES - 1) / OSCILLATOR_LANES;
+	for (int k = 0; k < OSCILLATOR_BANK_SIZE; k++)
+	{
+		//The unused lanes of the last group are silent partials.
+		ratios[k] = amplitudes[k] = startReal[k] = startImag[k] = 0;
+		decays[k] = 1;
+		if (k >= count)
+			continue;
+		const Partial& item = partials[k];
+		//a * sin(x) + b * cos(x) = sqrt(a^2 + b^2) * sin(x + atan2(b, a))
+		double phase = std::atan2(item.cosAmplitude, item.sinAmplitude);
+		ratios[k] = static_cast<float>(item.ratio);
+		amplitudes[k] = static_cast<float>(std::sqrt(item.sinAmplitude * item.sinAmplitude + item.cosAmplitude * item.cosAmplitude));
+		startReal[k] = static_cast<float>(std::cos(phase));
+		startImag[k] = static_cast<float>(std::sin(phase));
+		if (item.decayTime > 0)
+			decays[k] = static_cast<float>(std::exp(-CONTROL_RATE / (SAMPLE_RATE * item.decayTime)));
+	}
+}
+
+OscillatorBank::OscillatorBank(const Spectrum& _spectrum) : spectrum(&_spectrum)
+{
+	for (int k = 0; k < OSCILLATOR_BANK_SIZE; k++)
+	{
+		real[k] = spectrum->startReal[k];
+		imag[k] = spectrum->startImag[k];
+		stepReal[k] = 1;
+		stepImag[k] = 0;
+		gain[k] = gainStep[k] = 0;
+		level[k] = spectrum->amplitudes[k];
+	}
+}
+
+void OscillatorBank::SetFrequency(double frequency)
+{
+	nyquistRatio = static_cast<float>(SAMPLE_RATE / 2 / frequency);
+	double angle = pi2 * frequency / SAMPLE_RATE;
+	for (int k = 0; k < spectrum->count; k++)
+	{
+		stepReal[k] = static_cast<float>(std::cos(angle * spectrum->ratios[k]));
+		stepImag[k] = static_cast<float>(std::sin(angle * spectrum->ratios[k]));
+	}
+}
+
+void OscillatorBank::ControlPoint()
+{
+	int size = spectrum->groups * OSCILLATOR_LANES;
+	for (int k = 0; k < size; k++)
+	{
+		//One Newton step of 1 / sqrt(real^2 + imag^2), enough for the small drift of a control period.
+		float norm = (3 - (real[k] * real[k] + imag[k] * imag[k])) * 0.5f;
+		real[k] *= norm;
+		imag[k] *= norm;
+
+		float target = spectrum->ratios[k] < nyquistRatio ? level[k] : 0;
+		gainStep[k] = (target - gain[k]) / CONTROL_RATE;
+		//Flush a decayed partial to 0 before it becomes a denormal, which is many times slower to multiply.
+		level[k] = level[k] > SILENT_LEVEL ? level[k] * spectrum->decays[k] : 0;
+	}
+}
+
+void OscillatorBank::Render(float* out, size_t frames)
+{
+	//Each lane of acc sums one lane of all the groups, so the partials are only added across the lanes once per sample.
+	alignas(32) float acc[CONTROL_RATE][OSCILLATOR_LANES] = {};
+	for (int group = 0; group < spectrum->groups; group++)
+	{
+		alignas(32) float re[OSCILLATOR_LANES], im[OSCILLATOR_LANES], sr[OSCILLATOR_LANES], si[OSCILLATOR_LANES], g[OSCILLATOR_LANES], gs[OSCILLATOR_LANES];
+		int base = group * OSCILLATOR_LANES;
+		for (int k = 0; k < OSCILLATOR_LANES; k++)
+		{
+			re[k] = real[base + k];
+			im[k] = imag[base + k];
+			sr[k] = stepReal[base + k];
+			si[k] = stepImag[base + k];
+			g[k] = gain[base + k];
+			gs[k] = gainStep[base + k];
+		}
+		for (size_t n = 0; n < frames; n++)
+		{
+			for (int k = 0; k < OSCILLATOR_LANES; k++)
+			{
+				acc[n][k] += im[k] * g[k];
+				float r = re[k] * sr[k] - im[k] * si[k];
+				im[k] = re[k] * si[k] + im[k] * sr[k];
+				re[k] = r;
+				g[k] += gs[k];
+			}
+		}
+		for (int k = 0; k < OSCILLATOR_LANES; k++)
+		{
+			real[base + k] = re[k];
+			imag[base + k] = im[k];
+			gain[base + k] = g[k];
+		}
+	}
+	for (size_t n = 0; n < frames; n++)
+	{
+		float sum = 0;
+		for (int k = 0; k < OSCILLATOR_LANES; k++)
+			sum += acc[n][k];
+		out[n] = sum;
+	}
+}
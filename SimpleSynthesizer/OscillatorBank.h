@@ -0,0 +1,85 @@
+/*
+	SimpleSynthesizer V0.2
+	Oscillator bank for additive tones.
+	Every partial is a recursive quadrature oscillator: a unit complex number rotated by the step of its frequency each sample,
+	so no sin or cos is called while rendering. The partials are stored as a structure of arrays and advanced
+	OSCILLATOR_LANES at a time, which compilers turn into SIMD instructions (one AVX2 instruction per lane group).
+	The amplitude envelope of each partial is evaluated at control rate and ramps linearly in between.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <vector>
+
+constexpr int OSCILLATOR_LANES = 8;			//Partials advanced together. 8 floats fill an AVX2 register.
+constexpr int OSCILLATOR_BANK_SIZE = 32;	//Max partials of a bank. A multiple of OSCILLATOR_LANES.
+constexpr float SILENT_LEVEL = 1e-7f;		//A partial decayed below this level (-140dB) is muted.
+
+class OscillatorBank
+{
+public:
+	//amplitude of sin(2 * pi * ratio * f * t) + amplitude of cos(2 * pi * ratio * f * t), f is the fundamental frequency.
+	struct Partial
+	{
+		double ratio;
+		double sinAmplitude;
+		double cosAmplitude;
+		double decayTime;	//Seconds for the partial to decay to 1/e. 0 = no decay.
+	};
+
+	//The partials of an instrument, shared by all of its tones. Built once, before rendering.
+	class Spectrum
+	{
+	public:
+		int count;
+		int groups;		//Lane groups to be rendered.
+		float ratios[OSCILLATOR_BANK_SIZE];
+		float amplitudes[OSCILLATOR_BANK_SIZE];
+		float startReal[OSCILLATOR_BANK_SIZE];	//cos and sin of the start phase.
+		float startImag[OSCILLATOR_BANK_SIZE];
+		float decays[OSCILLATOR_BANK_SIZE];		//Level multiplier per control period.
+
+		//Throws if there are more than OSCILLATOR_BANK_SIZE partials.
+		Spectrum(const std::vector<Partial>& partials);
+	};
+
+protected:
+	const Spectrum* spectrum;
+	float nyquistRatio{ 0 };	//Partials with a higher ratio are above the Nyquist frequency and are muted.
+	//The oscillators. The output of a partial is imag * gain.
+	alignas(32) float real[OSCILLATOR_BANK_SIZE];
+	alignas(32) float imag[OSCILLATOR_BANK_SIZE];
+	alignas(32) float stepReal[OSCILLATOR_BANK_SIZE];
+	alignas(32) float stepImag[OSCILLATOR_BANK_SIZE];
+	alignas(32) float gain[OSCILLATOR_BANK_SIZE];
+	alignas(32) float gainStep[OSCILLATOR_BANK_SIZE];
+	alignas(32) float level[OSCILLATOR_BANK_SIZE];	//Envelope of the partial, before it is muted.
+
+public:
+	//The bank starts silent and ramps to the levels of the partials in the first control period.
+	OscillatorBank(const Spectrum& _spectrum);
+
+	//Keeps the phases, so that the frequency can be changed while playing.
+	void SetFrequency(double frequency);
+
+	//Called every CONTROL_RATE samples, before Render.
+	//Advances the envelopes of the partials and renormalizes the oscillators, which drift by rounding errors.
+	void ControlPoint();
+
+	//Write the sum of the partials to out. frames should not exceed CONTROL_RATE.
+	void Render(float* out, size_t frames);
+};
@@ -0,0 +1,116 @@
+/*
+	SimpleSynthesizer V0.2
+	Packed waveform bank.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include "PackedBank.h"
+
+static bool EntryLess(const PackedWaveform& a, const PackedWaveform& b)
+{
+	return a.bank < b.bank || (a.bank == b.bank && a.instrumentID < b.instrumentID);
+}
+
+bool PackedBank::Open(const std::filesystem::path& path, bool prefetch)
+{
+	Close();
+	file = std::make_shared<MappedFile>();
+	if (!file->Open(path, prefetch) || file->GetSize() < sizeof(PackedBankHeader))
+	{
+		Close();
+		return false;
+	}
+	const PackedBankHeader* header = reinterpret_cast<const PackedBankHeader*>(file->GetData());
+	size_t indexEnd = sizeof(PackedBankHeader) + static_cast<size_t>(header->count) * sizeof(PackedWaveform);
+	if (header->id != PACKED_BANK_ID || header->version != PACKED_BANK_VERSION || header->entrySize != sizeof(PackedWaveform)
+		|| indexEnd > file->GetSize())
+	{
+		Close();
+		return false;
+	}
+	const PackedWaveform* index = reinterpret_cast<const PackedWaveform*>(file->GetData() + sizeof(PackedBankHeader));
+	for (uint32_t i = 0; i < header->count; i++)
+	{
+		const PackedWaveform& entry = index[i];
+		//The samples should be aligned and in the file, and the index sorted for Find.
+		if ((entry.channels != 1 && entry.channels != 2) || entry.size < 2 || entry.offset % PACKED_BANK_ALIGNMENT != 0
+			|| entry.offset < indexEnd || entry.offset > file->GetSize()
+			|| entry.size > (file->GetSize() - entry.offset) / (entry.channels * sizeof(int16_t))
+			|| (i > 0 && EntryLess(entry, index[i - 1])))
+		{
+			Close();
+			return false;
+		}
+		//The positions are converted to fixed point phases, the frequency and a loop should be in range. Also false for NaN.
+		bool frequencyValid = std::isfinite(entry.frequencyBase) && entry.frequencyBase > 0;
+		bool loopValid = !entry.loop || (entry.loopStartAt >= 0 && entry.loopStartAt < entry.loopEndAt
+			&& entry.loopEndAt <= static_cast<double>(entry.size - 1));
+		if (!frequencyValid || !loopValid)
+		{
+			Close();
+			return false;
+		}
+	}
+	entries = index;
+	count = header->count;
+	return true;
+}
+
+void PackedBank::Close()
+{
+	file.reset();
+	entries = nullptr;
+	count = 0;
+}
+
+std::pair<const PackedWaveform*, const PackedWaveform*> PackedBank::Find(int bank, int instrumentID) const
+{
+	PackedWaveform key{};
+	key.bank = bank;
+	key.instrumentID = instrumentID;
+	return std::equal_range(entries, entries + count, key, EntryLess);
+}
+
+bool PackedBank::Write(const std::filesystem::path& path, std::vector<PackedWaveform>& entries, const std::vector<const int16_t*>& data)
+{
+	std::ofstream out(path, std::ios::out | std::ios::binary);
+	if (!out)
+		return false;
+
+	size_t offset = sizeof(PackedBankHeader) + entries.size() * sizeof(PackedWaveform);
+	for (auto& entry : entries)
+	{
+		offset = (offset + PACKED_BANK_ALIGNMENT - 1) / PACKED_BANK_ALIGNMENT * PACKED_BANK_ALIGNMENT;
+		entry.offset = offset;
+		offset += entry.size * entry.channels * sizeof(int16_t);
+	}
+
+	PackedBankHeader header{ PACKED_BANK_ID, PACKED_BANK_VERSION, static_cast<uint32_t>(entries.size()), sizeof(PackedWaveform) };
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(PackedWaveform));
+	const char padding[PACKED_BANK_ALIGNMENT] = {};
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		size_t position = static_cast<size_t>(out.tellp());
+		out.write(padding, entries[i].offset - position);
+		out.write(reinterpret_cast<const char*>(data[i]), entries[i].size * entries[i].channels * sizeof(int16_t));
+	}
+	return static_cast<bool>(out);
+}
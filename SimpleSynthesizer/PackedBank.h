@@ -0,0 +1,90 @@
+/*
+	SimpleSynthesizer V0.2
+	Packed waveform bank: all the waveforms of a waveform folder in one file, which is memory mapped.
+	The file starts with a PackedBankHeader and an index of PackedWaveform entries, sorted by bank and instrument ID.
+	The samples of each waveform follow, aligned to PACKED_BANK_ALIGNMENT bytes and stored as in WaveformTone::WaveformType:
+	16bit little endian, mono or interleaved stereo. Loading an instrument is a search of the index, no file is parsed.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <filesystem>
+#include "MappedFile.h"
+
+constexpr uint32_t PACKED_BANK_ID = 0x4b425353;		//"SSBK"
+constexpr uint32_t PACKED_BANK_VERSION = 1;
+constexpr size_t PACKED_BANK_ALIGNMENT = 64;		//Of the samples of each waveform. A cache line.
+
+struct PackedBankHeader
+{
+	uint32_t id;			//must be "SSBK"
+	uint32_t version;
+	uint32_t count;			//Entries of the index.
+	uint32_t entrySize;		//sizeof(PackedWaveform)
+};
+
+//An entry of the index, the fields of a WaveformTone::WaveformType.
+struct PackedWaveform
+{
+	int32_t bank;
+	int32_t instrumentID;
+	double pitch;
+	double pitchFrom;
+	double pitchTo;
+	double frequencyBase;
+	double loopStartAt;
+	double loopEndAt;
+	uint64_t size;			//Frames.
+	uint64_t offset;		//Of the samples, from the start of the file.
+	uint8_t loop;
+	uint8_t alwaysSustain;
+	uint16_t channels;
+	uint32_t reserved;
+};
+static_assert(sizeof(PackedBankHeader) == 16 && sizeof(PackedWaveform) == 80, "The packed bank layout should not depend on the compiler.");
+
+class PackedBank
+{
+protected:
+	//Shared with the waveforms loaded from it, so that it stays mapped while they are played.
+	std::shared_ptr<MappedFile> file;
+	const PackedWaveform* entries{ nullptr };
+	uint32_t count{ 0 };
+
+public:
+	//Map a packed bank and check its index. Returns false if it is not a valid packed bank.
+	bool Open(const std::filesystem::path& path, bool prefetch);
+	void Close();
+	bool IsOpen() const { return entries != nullptr; }
+
+	//The entries of an instrument, as a range [first, second).
+	std::pair<const PackedWaveform*, const PackedWaveform*> Find(int bank, int instrumentID) const;
+	const int16_t* GetData(const PackedWaveform& entry) const
+	{
+		return reinterpret_cast<const int16_t*>(file->GetData() + entry.offset);
+	}
+	const std::shared_ptr<MappedFile>& GetFile() const { return file; }
+
+	//Write a packed bank of the entries. data[n] holds the samples of entries[n]. The offsets of the entries are set here.
+	//The entries should be sorted by bank and instrument ID. Returns false if the file can not be written.
+	static bool Write(const std::filesystem::path& path, std::vector<PackedWaveform>& entries, const std::vector<const int16_t*>& data);
+};
@@ -0,0 +1,34 @@
+/*
+	SimpleSynthesizer V0.2
+	Pitch to frequency conversion without pow().
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <cmath>
+#include "PitchTable.h"
+
+double PitchTable::ratios[CENTS_PER_OCTAVE + 1];
+double PitchTable::octaves[PITCH_TABLE_OCTAVES];
+
+void PitchTable::Initialize()
+{
+	for (int n = 0; n <= CENTS_PER_OCTAVE; n++)
+		ratios[n] = std::pow(2.0, static_cast<double>(n) / CENTS_PER_OCTAVE);
+	ratios[0] = 1;
+	ratios[CENTS_PER_OCTAVE] = 2;
+	for (int n = 0; n < PITCH_TABLE_OCTAVES; n++)
+		octaves[n] = std::ldexp(1.0, n - PITCH_TABLE_OCTAVES / 2);
+}
@@ -0,0 +1,66 @@
+/*
+	SimpleSynthesizer V0.2
+	Pitch to frequency conversion without pow().
+	2 ^ x is split into whole octaves, which are looked up exactly, and the fraction of an octave, which is looked up in a table
+	of one entry per cent and interpolated linearly. The tables are about 10KB, so they stay in the cache.
+	The error is below 0.0001 cent. Whole octaves are exact. x should be within +-64 octaves.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+constexpr int CENTS_PER_OCTAVE = 1200;
+constexpr int PITCH_TABLE_OCTAVES = 128;	//-64 to 63
+
+class PitchTable
+{
+protected:
+	//ratios[n] = 2 ^ (n / 1200)
+	static double ratios[CENTS_PER_OCTAVE + 1];
+	//octaves[n] = 2 ^ (n - 64)
+	static double octaves[PITCH_TABLE_OCTAVES];
+
+public:
+	//Fill the tables. Called by Tone::InitializeTables.
+	static void Initialize();
+
+	//2 ^ x
+	static double Exp2(double x)
+	{
+		//Shifted to be positive, so that truncating is flooring.
+		double shifted = x + PITCH_TABLE_OCTAVES / 2;
+		if (shifted < 0)
+			shifted = 0;
+		else if (shifted >= PITCH_TABLE_OCTAVES)
+			shifted = PITCH_TABLE_OCTAVES - 1;
+		int octave = static_cast<int>(shifted);
+		double cents = (shifted - octave) * CENTS_PER_OCTAVE;
+		int n = static_cast<int>(cents);
+		return octaves[octave] * (ratios[n] + (ratios[n + 1] - ratios[n]) * (cents - n));
+	}
+
+	//Frequency ratio of an interval in semitones.
+	static double SemitonesToRatio(double semitones)
+	{
+		return Exp2(semitones / 12);
+	}
+
+	//Frequency of a pitch. 69 = A4 = 440Hz, increase or decrease by one per semitone.
+	static double PitchToFrequency(double pitch)
+	{
+		return 440 * Exp2((pitch - 69) / 12);
+	}
+};
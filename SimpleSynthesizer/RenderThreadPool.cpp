@@ -0,0 +1,122 @@
+/*
+	SimpleSynthesizer V0.2
+	Thread pool for rendering channels in parallel.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "RenderThreadPool.h"
+
+//How many times a thread polls before it sleeps on a condition variable.
+//Kept short, so that waiting threads do not take the cores of the render and sink threads
+//when there are fewer free cores than threads.
+constexpr int SPIN_COUNT = 64;
+
+RenderThreadPool::RenderThreadPool(int _threadCount)
+{
+	threadCount = _threadCount < 1 ? 1 : _threadCount;
+	ranges.reset(new JobRange[threadCount]);
+	for (int i = 1; i < threadCount; i++)
+		threads.emplace_back(&RenderThreadPool::Worker, this, i);
+}
+
+RenderThreadPool::~RenderThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		quit = true;
+	}
+	wakeUp.notify_all();
+	for (auto& item : threads)
+		item.join();
+}
+
+void RenderThreadPool::Run(size_t count, JobFunction _job, void* context)
+{
+	job = _job;
+	jobContext = context;
+	for (int i = 0; i < threadCount; i++)
+	{
+		ranges[i].next.store(count * i / threadCount, std::memory_order_relaxed);
+		ranges[i].end = count * (i + 1) / threadCount;
+	}
+	busyThreads.store(threadCount - 1, std::memory_order_relaxed);
+
+	if (threadCount > 1)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			generation.fetch_add(1, std::memory_order_release);
+		}
+		wakeUp.notify_all();
+	}
+
+	DoJobs(0);
+
+	//Wait for the others. Their results are visible after this.
+	int spin = 0;
+	while (busyThreads.load(std::memory_order_acquire) > 0 && spin < SPIN_COUNT)
+	{
+		std::this_thread::yield();
+		spin++;
+	}
+	if (busyThreads.load(std::memory_order_acquire) > 0)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		allDone.wait(lock, [&] { return busyThreads.load(std::memory_order_acquire) == 0; });
+	}
+}
+
+void RenderThreadPool::DoJobs(int threadIdx)
+{
+	for (int n = 0; n < threadCount; n++)
+	{
+		JobRange& range = ranges[(threadIdx + n) % threadCount];
+		size_t i;
+		while ((i = range.next.fetch_add(1, std::memory_order_relaxed)) < range.end)
+			job(jobContext, i);
+	}
+}
+
+void RenderThreadPool::Worker(int threadIdx)
+{
+	unsigned seen = 0;
+	while (true)
+	{
+		int spin = 0;
+		while (generation.load(std::memory_order_acquire) == seen && spin < SPIN_COUNT)
+		{
+			std::this_thread::yield();
+			spin++;
+		}
+		if (generation.load(std::memory_order_acquire) == seen)
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			wakeUp.wait(lock, [&] { return quit || generation.load(std::memory_order_acquire) != seen; });
+			if (quit)
+				return;
+		}
+		seen = generation.load(std::memory_order_acquire);
+
+		DoJobs(threadIdx);
+		if (busyThreads.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			//The last one wakes up the calling thread. Taking the lock makes sure that it is
+			//either still polling or already waiting.
+			std::lock_guard<std::mutex> lock(mtx);
+			allDone.notify_one();
+		}
+	}
+}
@@ -0,0 +1,72 @@
+/*
+	SimpleSynthesizer V0.2
+	Thread pool for rendering channels in parallel.
+	The calling thread works as one of the threads. Jobs are split evenly to the threads at first,
+	a thread that has finished its own jobs steals the rest from the others.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+
+class RenderThreadPool
+{
+public:
+	//A job is called with the context and the index of the job.
+	typedef void (*JobFunction)(void* context, size_t index);
+
+protected:
+	//Jobs of one thread. Other threads steal from it by advancing next.
+	struct alignas(64) JobRange
+	{
+		std::atomic<size_t> next{ 0 };
+		size_t end{ 0 };
+	};
+
+	std::vector<std::thread> threads;
+	std::unique_ptr<JobRange[]> ranges;
+	int threadCount;
+
+	JobFunction job{ nullptr };
+	void* jobContext{ nullptr };
+
+	std::mutex mtx;
+	std::condition_variable wakeUp;
+	std::condition_variable allDone;	//Signalled by the last worker to finish its jobs.
+	std::atomic<unsigned> generation{ 0 };	//Increased once per Run, wakes up the workers.
+	std::atomic<int> busyThreads{ 0 };
+	bool quit{ false };
+
+	void Worker(int threadIdx);
+	//Run the jobs of threadIdx, then steal from the others.
+	void DoJobs(int threadIdx);
+
+public:
+	//_threadCount is the total count of threads including the calling thread.
+	RenderThreadPool(int _threadCount);
+	~RenderThreadPool();
+
+	int GetThreadCount() const { return threadCount; }
+
+	//Call _job(context, i) for each i in [0, count) and wait until all are done.
+	void Run(size_t count, JobFunction _job, void* context);
+};
@@ -0,0 +1,199 @@
+/*
+	SimpleSynthesizer V0.2
+	Disk streaming of mapped waveforms.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include "SampleStreamer.h"
+
+void SampleStreamer::Start()
+{
+	if (running)
+		return;
+	running = true;
+	thread = std::thread(&SampleStreamer::Worker, this);
+}
+
+void SampleStreamer::Stop()
+{
+	running = false;
+	if (thread.joinable())
+		thread.join();
+	dropping.clear();
+	for (auto& stream : streams)
+	{
+		stream.active = false;
+		stream.generation += 2;
+		stream.claimed = false;
+	}
+}
+
+void SampleStreamer::Touch(const MappedFile* file, size_t offset, size_t bytes)
+{
+	if (bytes == 0)
+		return;
+	const volatile uint8_t* data = file->GetData() + offset;
+	uint8_t sum = 0;
+	for (size_t pos = 0; pos < bytes; pos += STREAM_PAGE_SIZE)
+		sum += data[pos];
+	sum += data[bytes - 1];
+	//Kept, so that the reads are not left out.
+	static std::atomic<uint8_t> sink{ 0 };
+	sink.store(sum, std::memory_order_relaxed);
+}
+
+void SampleStreamer::LoadHead(const MappedFile* file, size_t offset, size_t bytes)
+{
+	file->Prefetch(offset, bytes);
+	//Locking reads the pages too.
+	if (file->Lock(offset, bytes))
+		lockedBytes += bytes;
+	else
+		Touch(file, offset, bytes);
+	headBytes += bytes;
+}
+
+int SampleStreamer::Open(const MappedFile* file, size_t offset, size_t bytes, size_t head, size_t keep, unsigned& generation)
+{
+	for (int i = 0; i < MAX_SAMPLE_STREAMS; i++)
+	{
+		Stream& stream = streams[i];
+		bool expected = false;
+		if (stream.claimed.load(std::memory_order_relaxed) || !stream.claimed.compare_exchange_strong(expected, true, std::memory_order_acquire))
+			continue;
+		unsigned writing = stream.generation.fetch_add(1, std::memory_order_relaxed) + 1;
+		std::atomic_thread_fence(std::memory_order_release);
+		stream.file.store(file, std::memory_order_relaxed);
+		stream.offset.store(offset, std::memory_order_relaxed);
+		stream.bytes.store(bytes, std::memory_order_relaxed);
+		stream.head.store(head, std::memory_order_relaxed);
+		stream.keep.store(keep, std::memory_order_relaxed);
+		stream.consumed.store(0, std::memory_order_relaxed);
+		stream.wanted.store(head, std::memory_order_relaxed);
+		stream.ready.store(TagReady(head, writing + 1), std::memory_order_relaxed);
+		generation = stream.generation.fetch_add(1, std::memory_order_release) + 1;
+		stream.active.store(true, std::memory_order_release);
+		return i;
+	}
+	unstreamedVoices++;
+	return -1;
+}
+
+void SampleStreamer::Close(int stream, unsigned generation)
+{
+	Stream& item = streams[stream];
+	if (item.generation.load(std::memory_order_relaxed) != generation)
+		return;
+	item.active.store(false, std::memory_order_relaxed);
+	item.claimed.store(false, std::memory_order_release);
+}
+
+bool SampleStreamer::Advance(int stream, unsigned generation, size_t consumed, size_t position, size_t wanted)
+{
+	Stream& item = streams[stream];
+	if (item.generation.load(std::memory_order_relaxed) != generation)
+		return true;
+	item.consumed.store(consumed, std::memory_order_relaxed);
+	if (wanted > item.wanted.load(std::memory_order_relaxed))
+		item.wanted.store(wanted, std::memory_order_relaxed);
+	if (position <= ReadyBytes(item.ready.load(std::memory_order_acquire)))
+		return true;
+	underruns.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+void SampleStreamer::DropPassed()
+{
+	for (auto& item : dropping)
+	{
+		item.second.consumed = SIZE_MAX;
+		item.second.playing = false;
+	}
+	for (auto& stream : streams)
+	{
+		if (!stream.active.load(std::memory_order_acquire))
+			continue;
+		unsigned generation = stream.generation.load(std::memory_order_acquire);
+		const MappedFile* file = stream.file.load(std::memory_order_relaxed);
+		size_t offset = stream.offset.load(std::memory_order_relaxed);
+		size_t head = stream.head.load(std::memory_order_relaxed);
+		size_t keep = stream.keep.load(std::memory_order_relaxed);
+		size_t consumed = stream.consumed.load(std::memory_order_relaxed);
+		size_t ready = ReadyBytes(stream.ready.load(std::memory_order_relaxed));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (generation % 2 != 0 || stream.generation.load(std::memory_order_relaxed) != generation)
+			continue;
+		auto found = dropping.try_emplace({ file, offset }, Dropping{ head, keep, head, head, SIZE_MAX, false }).first;
+		found->second.read = (std::max)(found->second.read, ready);
+		found->second.consumed = (std::min)(found->second.consumed, consumed);
+		found->second.playing = true;
+	}
+	for (auto item = dropping.begin(); item != dropping.end();)
+	{
+		//When no voice plays the waveform any more, all it read is given back, but the loop.
+		Dropping& waveform = item->second;
+		size_t end = (std::min)({ waveform.playing ? waveform.consumed : SIZE_MAX, waveform.keep, waveform.read });
+		if (end > waveform.dropped && (end - waveform.dropped >= STREAM_DROP_BYTES || !waveform.playing))
+		{
+			item->first.first->Drop(item->first.second + waveform.dropped, end - waveform.dropped);
+			droppedBytes.fetch_add(end - waveform.dropped, std::memory_order_relaxed);
+			waveform.dropped = end;
+		}
+		if (waveform.playing)
+			++item;
+		else
+			item = dropping.erase(item);
+	}
+}
+
+void SampleStreamer::Worker()
+{
+	while (running)
+	{
+		bool busy = false;
+		for (auto& stream : streams)
+		{
+			if (!stream.active.load(std::memory_order_acquire))
+				continue;
+			unsigned generation = stream.generation.load(std::memory_order_acquire);
+			const MappedFile* file = stream.file.load(std::memory_order_relaxed);
+			size_t offset = stream.offset.load(std::memory_order_relaxed);
+			size_t bytes = stream.bytes.load(std::memory_order_relaxed);
+			uint64_t tagged = stream.ready.load(std::memory_order_relaxed);
+			size_t wanted = stream.wanted.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (generation % 2 != 0 || stream.generation.load(std::memory_order_relaxed) != generation || tagged != TagReady(ReadyBytes(tagged), generation))
+				continue;
+			size_t ready = ReadyBytes(tagged);
+			size_t end = (std::min)({ wanted, ready + STREAM_READ_BYTES, bytes });
+			if (end <= ready)
+				continue;
+			//The file stays mapped while the I/O thread runs, even if the voice closes the stream meanwhile.
+			file->Prefetch(offset + ready, end - ready);
+			Touch(file, offset + ready, end - ready);
+			//Not published if the stream was opened again meanwhile, for a voice that has its own ready.
+			stream.ready.compare_exchange_strong(tagged, TagReady(end, generation), std::memory_order_release, std::memory_order_relaxed);
+			readBytes.fetch_add(end - ready, std::memory_order_relaxed);
+			busy = true;
+		}
+		DropPassed();
+		if (!busy)
+			std::this_thread::sleep_for(std::chrono::milliseconds(STREAM_POLL_MILLISECONDS));
+	}
+}
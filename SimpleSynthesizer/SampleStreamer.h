@@ -0,0 +1,118 @@
+/*
+	SimpleSynthesizer V0.2
+	Disk streaming of mapped waveforms.
+	A waveform mapped from a file is read by the system when a voice first touches it, which stalls the render thread for
+	as long as the disk takes. When streaming, the head of every waveform is read (and locked, if the system allows) when
+	it is loaded, and an I/O thread reads the rest ahead of the voices playing it: every voice owns a stream, tells it
+	how far it will read, and the I/O thread touches the pages up to there. The pages of the mapped file are the buffers
+	of the streams: once all the voices of a waveform have passed some pages, the I/O thread gives them back to the system,
+	so that only the heads, the loops and the pages around the voices stay in memory. A voice that is about to read pages
+	not read yet is held silent, instead of waiting for the disk on the render thread.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <thread>
+#include <map>
+#include "MappedFile.h"
+
+constexpr int MAX_SAMPLE_STREAMS = 1024;			//Voices streamed at once. The others read the mapped files without read ahead.
+constexpr size_t STREAM_PAGE_SIZE = 4096;			//The I/O thread touches one byte per page.
+constexpr size_t STREAM_READ_BYTES = 256 * 1024;	//Read for one stream before going on to the next, so that a stream far behind does not hold up the others.
+constexpr int STREAM_POLL_MILLISECONDS = 1;			//Sleep of the I/O thread when all the streams are read far enough.
+constexpr size_t STREAM_DROP_BYTES = 64 * 1024;		//Passed pages of a waveform are given back in batches of at least this.
+
+class SampleStreamer
+{
+protected:
+	struct alignas(64) Stream
+	{
+		std::atomic<bool> claimed{ false };
+		std::atomic<bool> active{ false };
+		//Odd while Open writes the fields below, and increased again when done. The I/O thread reads them only when it
+		//sees the same even generation before and after. A stale owner can not touch a reused stream.
+		std::atomic<unsigned> generation{ 0 };
+		std::atomic<const MappedFile*> file{ nullptr };
+		std::atomic<size_t> offset{ 0 };		//Of the samples in the file.
+		std::atomic<size_t> bytes{ 0 };
+		std::atomic<size_t> head{ 0 };			//Bytes from offset read when the waveform was loaded. Never dropped.
+		std::atomic<size_t> keep{ 0 };			//Bytes from offset after which nothing is dropped: the start of the loop.
+		std::atomic<size_t> consumed{ 0 };		//Bytes from offset the voice has passed.
+		std::atomic<size_t> wanted{ 0 };		//Bytes from offset the voice will have read at the end of the lookahead.
+		//Bytes from offset that were read, tagged with the generation: the I/O thread publishes them with compare_exchange,
+		//which fails if the stream was closed and opened again while it was reading.
+		std::atomic<uint64_t> ready{ 0 };
+	};
+	//The low bits of ready hold the generation.
+	static constexpr int READY_TAG_BITS = 16;
+	static uint64_t TagReady(size_t bytes, unsigned generation) { return (static_cast<uint64_t>(bytes) << READY_TAG_BITS) | (generation & ((1u << READY_TAG_BITS) - 1)); }
+	static size_t ReadyBytes(uint64_t ready) { return static_cast<size_t>(ready >> READY_TAG_BITS); }
+
+	//The pages given back of each waveform played, by file and offset. Used by the I/O thread only.
+	struct Dropping
+	{
+		size_t head;
+		size_t keep;
+		size_t read;		//Bytes from offset read for the voices.
+		size_t dropped;		//Bytes from offset up to which the pages were given back.
+		size_t consumed;	//The least of the voices playing the waveform in this pass.
+		bool playing;
+	};
+	std::map<std::pair<const MappedFile*, size_t>, Dropping> dropping;
+
+	Stream streams[MAX_SAMPLE_STREAMS];
+	std::thread thread;
+	std::atomic<bool> running{ false };
+
+	void Worker();
+	//Give back the pages all the voices of each waveform have passed, and all but the head and the loop of the waveforms
+	//no longer played.
+	void DropPassed();
+	//Read the pages of bytes at offset of file, by touching them.
+	static void Touch(const MappedFile* file, size_t offset, size_t bytes);
+
+public:
+	//Statistics
+	std::atomic<uint64_t> underruns{ 0 };		//Blocks a voice was to render beyond what was read.
+	std::atomic<uint64_t> unstreamedVoices{ 0 };	//Voices that found no free stream.
+	std::atomic<uint64_t> readBytes{ 0 };		//Read ahead by the I/O thread.
+	std::atomic<uint64_t> headBytes{ 0 };		//Read when the waveforms were loaded.
+	std::atomic<uint64_t> lockedBytes{ 0 };		//Of headBytes, locked in memory.
+	std::atomic<uint64_t> droppedBytes{ 0 };	//Given back to the system after the voices passed them.
+
+	~SampleStreamer() { Stop(); }
+
+	void Start();
+	//Stop the I/O thread and close all the streams. Call before the files are unmapped.
+	void Stop();
+	bool IsRunning() const { return running; }
+
+	//Read the head of a waveform, bytes at offset of file, and keep it in memory if the system allows.
+	void LoadHead(const MappedFile* file, size_t offset, size_t bytes);
+
+	//Start streaming bytes at offset of file for a voice, of which the head bytes are read already. The bytes after keep,
+	//the loop, stay in memory as long as the waveform is played. Returns the stream, and its generation which the voice
+	//passes back. -1 if no stream is free.
+	int Open(const MappedFile* file, size_t offset, size_t bytes, size_t head, size_t keep, unsigned& generation);
+	void Close(int stream, unsigned generation);
+	//The voice has passed consumed, is going to read up to position, and wants up to wanted read ahead. Called by the
+	//render thread once a block. Returns false, and counts an underrun, if position is not read yet.
+	bool Advance(int stream, unsigned generation, size_t consumed, size_t position, size_t wanted);
+};
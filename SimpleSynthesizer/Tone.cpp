@@ -22,28 +22,48 @@
 #include <math.h>
 #include <vector>
 #include <iostream>
+#include <mutex>
 #include "Tone.h"
 #include "WaveformTone.h"
+#include "VoicePool.h"
 
+bool Tone::zeroResonanceOff = false;
 
 //Static
-Tone* Tone::CreateTone(int bank, int GMInstrument, const double _pitch, const uint8_t _velocity /*= 127*/)
+void Tone::InitializeTables()
+{
+	static std::once_flag once;
+	std::call_once(once, [] {
+		PitchTable::Initialize();
+		Wavetable::Initialize();
+		Interpolation::Initialize();
+	});
+}
+
+bool Tone::PrepareVoice(VoiceBatch&, int, size_t, bool&)
+{
+	return false;
+}
+
+//Static
+Tone* Tone::CreateTone(VoicePool& pool, int bank, int GMInstrument, const double _pitch, const uint8_t _velocity /*= 127*/)
 {
 //	return new WaveformTone(_track, _channel, bank, 35, _pitch, _velocity);
 	if (bank < 512)
 	{
 		WaveformTone::MapGMInstrument(GMInstrument);
 		if (GMInstrument == 80)
-			return new GM080_Square(bank, 80, _pitch, _velocity);
+			return pool.Create<GM080_Square>(bank, 80, _pitch, _velocity);
 		else if (GMInstrument == 81)
-			return new GM081_Triangle(bank, 81, _pitch, _velocity);
+			return pool.Create<GM081_Triangle>(bank, 81, _pitch, _velocity);
 		else
-			return new WaveformTone(bank, GMInstrument, _pitch, _velocity);
+			return pool.Create<WaveformTone>(bank, GMInstrument, _pitch, _velocity);
 	}
 	else
 	{
-		Tone* pTone = new WaveformTone(bank, 0, _pitch, _velocity);
-		pTone->SetSustain(true);
+		Tone* pTone = pool.Create<WaveformTone>(bank, 0, _pitch, _velocity);
+		if (pTone)
+			pTone->SetSustain(true);
 		return pTone;
 	}
 }
@@ -82,187 +102,201 @@ bool GM001_GrandPiano::Envelope(double& g)
 	}
 }
 
-double GM001_GrandPiano::ToneGenerator()
+//The base, the half harmonic and 9 harmonic waves. Ratios are of the base, so the half harmonic is 0.5.
+//The higher a partial is, the faster it decays, so the tone mellows after the attack.
+const OscillatorBank::Spectrum& GM001_GrandPiano::GetSpectrum()
 {
-	double t = toneSampleCount / SAMPLE_RATE;
-	toneSampleCount++;
-
-	double lenBase = pi2 * frequency * t;
-	double len = lenBase;
-	//Base
-	double g1 = sin(len);
-	//Harmonic waves :
-/*	double g0 = 0.437 * (sin(2 * pi * 0.5 * frequency * t) * cos(0.2792) + cos(2 * pi * 0.5 * frequency * t) * sin(0.2792));	//half
-	double g2 = 0.260 * (sin(2 * pi * 2 * frequency * t) * cos(2.5382) + cos(2 * pi * 2 * frequency * t) * sin(2.5382));		//
-	double g3 = 0.182 * (sin(2 * pi * 3 * frequency * t) * cos(-0.866) + cos(2 * pi * 3 * frequency * t) * sin(-0.866));
-	double g4 = 0.121 * (sin(2 * pi * 4 * frequency * t) * cos(3.553) + cos(2 * pi * 4 * frequency * t) * sin(3.553));
-	double g5 = 0.144 * (sin(2 * pi * 5 * frequency * t) * cos(0.777) + cos(2 * pi * 5 * frequency * t) * sin(0.777));
-	double g6 = 0.136 * (sin(2 * pi * 6 * frequency * t) * cos(1.593) + cos(2 * pi * 6 * frequency * t) * sin(1.593));
-	double g7 = 0.016 * (sin(2 * pi * 7 * frequency * t) * cos(4.9) + cos(2 * pi * 7 * frequency * t) * sin(4.9));
-	double g8 = 0.054 * (sin(2 * pi * 8 * frequency * t) * cos(-0.074) + cos(2 * pi * 8 * frequency * t) * sin(-0.074));
-	double g9 = 0.092 * (sin(2 * pi * 9 * frequency * t) * cos(0.2) + cos(2 * pi * 9 * frequency * t) * sin(0.2));
-	double g10 = 0.052 * (sin(2 * pi * 10 * frequency * t) * cos(-0.3) + cos(2 * pi * 10 * frequency * t) * sin(-0.3));
-*/
-	double g0 = 0.437 * (sin(len * 0.5) * 0.9613 + cos(len * 0.5) * 0.2756);	//half
-	len += lenBase;
-	double g2 = 0.260 * (sin(len) * -0.8234 + cos(len) * 0.7057);		//
-	len += lenBase;
-	double g3 = 0.182 * (sin(len) * 0.4679 + cos(len) * -0.7617);
-	len += lenBase;
-	double g4 = 0.121 * (sin(len) * -0.9166 + cos(len) * -0.3999);
-	len += lenBase;
-	double g5 = 0.144 * (sin(len) * 0.7130 + cos(len) * 0.7011);
-	len += lenBase;
-	double g6 = 0.136 * (sin(len) * -0.022 + cos(len) * 0.9999);
-	len += lenBase;
-	double g7 = 0.016 * (sin(len) * 0.1865 + cos(len) * -0.9825);
-	len += lenBase;
-	double g8 = 0.054 * (sin(len) * 0.9973 + cos(len) * -0.0739);
-	len += lenBase;
-	double g9 = 0.092 * (sin(len) * 0.9800 + cos(len) * 0.1987);
-	len += lenBase;
-	double g10= 0.052 * (sin(len) * 0.9553 + cos(len) * -0.2955);
+	static const OscillatorBank::Spectrum spectrum({
+		{ 0.5, 0.437 * 0.9613, 0.437 * 0.2756, PIANO_PARTIAL_DECAY * 2 },
+		{ 1, 1, 0, PIANO_PARTIAL_DECAY },
+		{ 2, 0.260 * -0.8234, 0.260 * 0.7057, PIANO_PARTIAL_DECAY / 2 },
+		{ 3, 0.182 * 0.4679, 0.182 * -0.7617, PIANO_PARTIAL_DECAY / 3 },
+		{ 4, 0.121 * -0.9166, 0.121 * -0.3999, PIANO_PARTIAL_DECAY / 4 },
+		{ 5, 0.144 * 0.7130, 0.144 * 0.7011, PIANO_PARTIAL_DECAY / 5 },
+		{ 6, 0.136 * -0.022, 0.136 * 0.9999, PIANO_PARTIAL_DECAY / 6 },
+		{ 7, 0.016 * 0.1865, 0.016 * -0.9825, PIANO_PARTIAL_DECAY / 7 },
+		{ 8, 0.054 * 0.9973, 0.054 * -0.0739, PIANO_PARTIAL_DECAY / 8 },
+		{ 9, 0.092 * 0.9800, 0.092 * 0.1987, PIANO_PARTIAL_DECAY / 9 },
+		{ 10, 0.052 * 0.9553, 0.052 * -0.2955, PIANO_PARTIAL_DECAY / 10 }
+	});
+	return spectrum;
+}
 
-	// Combine all the harmonic waves together
-	double g = g0 + g1 + g2 + g3 + g4 + g5 + g6 + g7 + g8 + g9 + g10;
-	//Then normalize to 60% of maximum volume
-	g *= 32767 * 0.6 / ((1 + 0.437 + 0.260 + 0.182 + 0.121 + 0.144 + 0.136 + 0.016 + 0.054 + 0.092 + 0.052) * 2);
-	return g;
+void GM001_GrandPiano::ControlPoint()
+{
+	if (ControlPeriod())
+		ChangeFrequency(PitchFrequency());
+	bank.ControlPoint();
+	controlCountdown = CONTROL_RATE;
 }
 
 bool GM001_GrandPiano::TriggerPulse(double& gl, double& gr)
 {
-	double g = ToneGenerator();
-	if (Envelope(g))
+	return RenderPulse(gl, gr);
+}
+
+bool GM001_GrandPiano::RenderBlock(SampleType* left, SampleType* right, size_t frames)
+{
+	//Normalize to 60% of maximum volume
+	constexpr double normalize = 32767 * 0.6 / ((1 + 0.437 + 0.260 + 0.182 + 0.121 + 0.144 + 0.136 + 0.016 + 0.054 + 0.092 + 0.052) * 2);
+	double volume = normalize * velocity / 127 * (soft ? 0.5 : 1);
+	double panLeft = autoStereo ? 1 - (pitch / 127 * 0.6 + 0.2) : 1;
+	double panRight = autoStereo ? pitch / 127 * 0.6 + 0.2 : 1;
+	float partials[CONTROL_RATE];
+	for (size_t i = 0; i < frames; )
 	{
-		g *= static_cast<double>(velocity) / 127;
-		if (soft)
-			g *= 0.5;
-		if (autoStereo)
+		if (controlCountdown == 0)
+			ControlPoint();
+		size_t count = (std::min)(frames - i, static_cast<size_t>(controlCountdown));
+		bank.Render(partials, count);
+		controlCountdown -= static_cast<int>(count);
+		for (size_t n = 0; n < count; n++, i++)
 		{
-			gl = (1 - (pitch / 127 * 0.6 + 0.2)) * g;
-			gr = (pitch / 127 * 0.6 + 0.2) * g;
+			double g = partials[n] * volume;
+			if (!Envelope(g))
+			{
+				for (; i < frames; i++)
+					left[i] = right[i] = 0;
+				return false;
+			}
+			left[i] = static_cast<SampleType>(g * panLeft);
+			right[i] = static_cast<SampleType>(g * panRight);
 		}
-		else
-			gl = gr = g;
-		return true;
-	}
-	else
-	{
-		gl = gr = 0;
-		return false;
 	}
+	return true;
 }
 
-bool GM080_Square::TriggerPulse(double& gl, double& gr)
+void WavetableTone::RenderOscillator(double* out, size_t frames)
 {
-	if (portamentoEnable)
+	for (size_t i = 0; i < frames; )
 	{
-		PortamentoAdjust();	//portamentoEnable will be set to false when done.
+		size_t count = frames - i;
+		if (controlCountdown == 0 && ControlPeriod())
+		{
+			frequencyStep = (PitchFrequency() - frequency) / CONTROL_RATE;
+			controlCountdown = CONTROL_RATE;
+		}
+		if (controlCountdown > 0)
+		{
+			//Ramp to the frequency at the end of the control period. The first sample is already one step on.
+			count = (std::min)(count, static_cast<size_t>(controlCountdown));
+			controlCountdown -= static_cast<int>(count);
+			oscillator.SetFrequency(frequency + frequencyStep);
+			oscillator.Render(out + i, count, frequencyStep);
+			ChangeFrequency(frequency + frequencyStep * count);
+		}
+		else
+			oscillator.Render(out + i, count, 0);
+		i += count;
 	}
+}
 
-	double t = toneSampleCount / SAMPLE_RATE;
-	toneSampleCount++;
-
-	//Base only
-	double fractionPart = frequency * t - static_cast<long long>(frequency * t);
-	double g = (fractionPart > 0.5 ? 1 - fractionPart : fractionPart) * 64 - 16;
-	if (g > 1)
-		g = 1;
-	if (g < -1)
-		g = -1;
+bool GM080_Square::TriggerPulse(double& gl, double& gr)
+{
+	return RenderPulse(gl, gr);
+}
 
-	//Attack
-	if (releaseVelocity == -1)
+bool GM080_Square::RenderBlock(SampleType* left, SampleType* right, size_t frames)
+{
+	//Normalize to 20% of maximum volume, then velocity.
+	double volume = 32767 * 0.2 * velocity / 127 * (soft ? 0.5 : 1);
+	double panLeft = autoStereo ? 1 - (pitch / 127 * 0.6 + 0.2) : 1;
+	double panRight = autoStereo ? pitch / 127 * 0.6 + 0.2 : 1;
+	bool release = releaseVelocity >= 0 && !GetSustain();
+	double g[TONE_CHUNK_SIZE];
+	for (size_t start = 0; start < frames; start += TONE_CHUNK_SIZE)
 	{
-		evlpSampleCount++;
-		if (evlpSampleCount < 50)
+		size_t count = (std::min)(frames - start, TONE_CHUNK_SIZE);
+		//Base only
+		RenderOscillator(g, count);
+		//Attack
+		if (releaseVelocity == -1)
 		{
-			g *= static_cast<double>(evlpSampleCount) / 50;
+			for (size_t n = 0; n < count; n++)
+			{
+				evlpSampleCount++;
+				if (evlpSampleCount < 50)
+					g[n] *= static_cast<double>(evlpSampleCount) / 50;
+			}
 		}
-	}
-
-	//Resonance
-	g = bandPassFilter.TriggerPulse(g) * 2 + g;
-	//Cutoff
-	g = lowPassFilter.TriggerPulse(g);
+		//Resonance
+		bandPassFilter.Mix(g, count, 2);
+		//Cutoff
+		lowPassFilter.Process(g, count);
 
-	//Then normalize to 20% of maximum volume
-	g *= 32767 * 0.2;
-	//Velocity
-	g *= static_cast<double>(velocity) / 127;
-	if (soft)
-		g *= 0.5;
-	if (autoStereo)
-	{
-		gl = (1 - (pitch / 127 * 0.6 + 0.2)) * g;
-		gr = (pitch / 127 * 0.6 + 0.2) * g;
-	}
-	else
-		gl = gr = g;
-	if (releaseVelocity >= 0 && !GetSustain())
-	{
-		gl *= static_cast<double>(evlpSampleCount) / releaseVelocity;
-		gr *= static_cast<double>(evlpSampleCount) / releaseVelocity;
-		evlpSampleCount -= 5;
-		if (evlpSampleCount <= 5)
-			return false;
+		for (size_t n = 0; n < count; n++)
+		{
+			double gl = g[n] * volume * panLeft;
+			double gr = g[n] * volume * panRight;
+			if (release)
+			{
+				gl *= static_cast<double>(evlpSampleCount) / releaseVelocity;
+				gr *= static_cast<double>(evlpSampleCount) / releaseVelocity;
+				evlpSampleCount -= 5;
+				if (evlpSampleCount <= 5)
+				{
+					for (size_t i = start + n; i < frames; i++)
+						left[i] = right[i] = 0;
+					return false;
+				}
+			}
+			left[start + n] = static_cast<SampleType>(gl);
+			right[start + n] = static_cast<SampleType>(gr);
+		}
 	}
 	return true;
 }
 
 bool GM081_Triangle::TriggerPulse(double& gl, double& gr)
 {
-	if (portamentoEnable)
-	{
-		PortamentoAdjust();	//portamentoEnable will be set to false when done.
-	}
-
-	double t = toneSampleCount / SAMPLE_RATE;
-	toneSampleCount++;
-
-	//Base only
-	double fractionPart = frequency * t - static_cast<long long>(frequency * t);
-//	double g = (fractionPart > 0.5 ? 1 - fractionPart : fractionPart) * 4 - 1;
-	double g = (fractionPart > 0.2 ? (1 - fractionPart) * 5 / 8 : fractionPart * 2.5) * 4 - 1;
-	//Resonance
-	g = bandPassFilter.TriggerPulse(g) * 2 + g;
-	//Cutoff
-	g = lowPassFilter.TriggerPulse(g);
-	//Then normalize to 50% of maximum volume
-	g *= 32767 * 0.5;
-	//Velocity
-	g *= static_cast<double>(velocity) / 127;
+	return RenderPulse(gl, gr);
+}
 
-	//Attack
-	if (releaseVelocity == -1)
+bool GM081_Triangle::RenderBlock(SampleType* left, SampleType* right, size_t frames)
+{
+	//Normalize to 50% of maximum volume, then velocity.
+	double volume = 32767 * 0.5 * velocity / 127 * (soft ? 0.5 : 1);
+	double panLeft = autoStereo ? 1 - (pitch / 127 * 0.6 + 0.2) : 1;
+	double panRight = autoStereo ? pitch / 127 * 0.6 + 0.2 : 1;
+	bool release = releaseVelocity >= 0 && !GetSustain();
+	double g[TONE_CHUNK_SIZE];
+	for (size_t start = 0; start < frames; start += TONE_CHUNK_SIZE)
 	{
-		evlpSampleCount++;
-		if (evlpSampleCount < 50)
+		size_t count = (std::min)(frames - start, TONE_CHUNK_SIZE);
+		//Base only
+		RenderOscillator(g, count);
+		//Resonance
+		bandPassFilter.Mix(g, count, 2);
+		//Cutoff
+		lowPassFilter.Process(g, count);
+
+		for (size_t n = 0; n < count; n++)
 		{
-			g *= static_cast<double>(evlpSampleCount) / 50;
+			double v = g[n] * volume;
+			//Attack
+			if (releaseVelocity == -1)
+			{
+				evlpSampleCount++;
+				if (evlpSampleCount < 50)
+					v *= static_cast<double>(evlpSampleCount) / 50;
+			}
+			double gl = v * panLeft;
+			double gr = v * panRight;
+			if (release)
+			{
+				gl *= static_cast<double>(evlpSampleCount) / releaseVelocity;
+				gr *= static_cast<double>(evlpSampleCount) / releaseVelocity;
+				evlpSampleCount -= 2;
+				if (evlpSampleCount == 1 || evlpSampleCount == 0)
+				{
+					for (size_t i = start + n; i < frames; i++)
+						left[i] = right[i] = 0;
+					return false;
+				}
+			}
+			left[start + n] = static_cast<SampleType>(gl);
+			right[start + n] = static_cast<SampleType>(gr);
 		}
 	}
-
-	if (soft)
-		g *= 0.5;
-	if (autoStereo)
-	{
-		gl = (1 - (pitch / 127 * 0.6 + 0.2)) * g;
-		gr = (pitch / 127 * 0.6 + 0.2) * g;
-	}
-	else
-		gl = gr = g;
-
-	if (releaseVelocity >= 0 && !GetSustain())
-	{
-		gl *= static_cast<double>(evlpSampleCount) / releaseVelocity;
-		gr *= static_cast<double>(evlpSampleCount) / releaseVelocity;
-		evlpSampleCount -= 2;
-		if (evlpSampleCount == 1 || evlpSampleCount == 0)
-			return false;
-	}
-
 	return true;
-
 }
@@ -3,6 +3,8 @@
     Tone generators for piano, squarewave(GM80) and trianglewave(GM81).
     The piano's harmonic wave params are taken from https://github.com/yuriecyx/merrychristmas
     Piano tone generator is not used for playing MIDI files instead a piano waveform is used.
+    The piano is additive: its partials are played by an OscillatorBank (OscillatorBank.h), each with its own decay.
+    Square and triangle read band limited wavetables (Wavetable.h) built from their harmonics, so high notes do not alias.
 
     Copyright (C) 2021 Feng Dai
 
@@ -29,8 +31,28 @@ constexpr double pi2 = pi * 2;
 constexpr double MAX_MODULATION_FREQ = 10;
 constexpr double MAX_MODULATION_PITCH = 1;
 constexpr double PORTAMENTO_SPEED_CONST = 5;
+constexpr double PIANO_PARTIAL_DECAY = 3;   //Seconds for the base of the piano to decay to 1/e. A partial n times higher decays n times faster.
+constexpr int CONTROL_RATE = 16;    //Samples per control period. Vibrato, portamento and pitch bend are evaluated once a period.
+constexpr size_t TONE_CHUNK_SIZE = 64;  //Samples a synthetic tone renders at once, in a buffer on its stack.
+
+//Sample type of the signal chain: tone blocks, mixing busses and effect delay lines.
+//Define USE_FLOAT_ENGINE as false to run the whole chain in double.
+#ifndef USE_FLOAT_ENGINE
+#define USE_FLOAT_ENGINE true
+#endif
+#if (USE_FLOAT_ENGINE)
+typedef float SampleType;
+#else
+typedef double SampleType;
+#endif
 
 #include "Filters.h"
+#include "PitchTable.h"
+#include "Wavetable.h"
+#include "OscillatorBank.h"
+class VoicePool;
+class VoiceBatch;
+
 class Tone
 {
 protected:
@@ -53,39 +75,138 @@ protected:
     bool sustainFlipped;    //Sustain status can change from true to false for only once.
     bool soft;              //Volume decrease by 50%
     bool autoStereo;        //[Deleted] Generate stereo signal in accordance with the piano keyboard arrangement -- bass on the left, treble on the right.
-    double portamentoStep;  //How many pitch (in double) should change per pulse during portamento. 
+    double portamentoStep;  //How many pitch (in double) should change per sample during portamento. 
     double portamentoPitchDiff; //The pitch difference between portamento target pitch and start pitch.
     bool portamentoEnable;  //Set true when should do portamento. Will be set false when done.
+    //Control rate
+    int controlCountdown{ 0 };  //Samples to the next control point.
+    double frequencyStep{ 0 };  //The frequency ramps to the target of the control period by this step per sample.
+    bool pitchChanged{ false }; //Pitch bend or modulation changed, the frequency should ramp to it at the next control point.
 
     //Filters
     LowPassFilter_1Order lowPassFilter; 
     BandPassFilter bandPassFilter;      //For resonance.
+    static bool zeroResonanceOff;       //A resonance of 0 skips the resonance filter. False by default.
 
+    //Fundamental frequency of pitch, pitch bend, modulation bend and portamento.
+    double PitchFrequency() const
+    {
+        return PitchTable::PitchToFrequency(pitch + pitchBend + modulationBend + portamentoPitchDiff);
+    }
     //Calculate fundamental frequency with pitch, pitch bend and modulation bend value.
     virtual void SetFrequency()
     {
-        frequency = 440 * pow(2, ((pitch + pitchBend + modulationBend + portamentoPitchDiff - 69) / 12));
+        frequency = PitchFrequency();
     }
-    virtual void ReCalibrateFrequency()
+    //Change the frequency of a sounding tone.
+    virtual void ChangeFrequency(double newFrequency)
     {
-        double frequencySave = frequency;
-        SetFrequency();
         //Adjust toneSampleCount so that the frequency change does not affect the wave alignments.
-        double t = toneSampleCount / SAMPLE_RATE;
-        double len = pi2 * frequencySave * t;
-        toneSampleCount = len / pi2 / frequency * SAMPLE_RATE;
+        toneSampleCount = toneSampleCount * frequency / newFrequency;
+        frequency = newFrequency;
+    }
+    virtual void ReCalibrateFrequency()
+    {
+        ChangeFrequency(PitchFrequency());
     }
-    virtual void PortamentoAdjust()
+    //Advance the portamento by samples. The pitch moves by portamentoStep every sample, towards the target, and
+    //portamentoEnable is set to false when it is reached.
+    void AdvancePortamento(int samples)
     {
-        //portamentoEnable will be set to false when done.
-        if (std::fabs(portamentoPitchDiff) <= std::fabs(portamentoStep))
+        if (!portamentoEnable)
+            return;
+        if (std::fabs(portamentoPitchDiff) <= std::fabs(portamentoStep) * samples)
         {
             portamentoPitchDiff = 0;
             portamentoEnable = false;
         }
         else
-            portamentoPitchDiff += portamentoStep;
-        ReCalibrateFrequency();
+            portamentoPitchDiff += portamentoStep * samples;
+    }
+    //Advance the modulation by samples. The bend moves by modulationPitchChangePerSample every sample and turns at the first
+    //sample past the depth, a triangle wave. The samples to the next turn are counted by a division, not sample by sample.
+    void AdvanceModulation(int samples)
+    {
+        if (modulationDepth == 0 || modulationPitchChangePerSample <= 0)
+            return;
+        double limit = static_cast<double>(modulationDepth) / (128 / MAX_MODULATION_PITCH);
+        while (samples > 0)
+        {
+            double distance = modulationDirection > 0 ? limit - modulationBend : modulationBend + limit;
+            double toTurn = distance < 0 ? 1 : std::floor(distance / modulationPitchChangePerSample) + 1;
+            if (toTurn > samples)
+            {
+                modulationBend += modulationPitchChangePerSample * modulationDirection * samples;
+                return;
+            }
+            modulationBend += modulationPitchChangePerSample * modulationDirection * toTurn;
+            modulationDirection = -modulationDirection;
+            samples -= static_cast<int>(toTurn);
+        }
+    }
+
+    //Advance the modulation and the portamento by a whole control period.
+    //Returns false if the frequency stays the same.
+    bool ControlPeriod()
+    {
+        if (modulationDepth == 0 && !portamentoEnable && !pitchChanged)
+            return false;
+        pitchChanged = false;
+        AdvanceModulation(CONTROL_RATE);
+        AdvancePortamento(CONTROL_RATE);
+        return true;
+    }
+
+    //Advance vibrato, portamento and pitch bend by one sample, at control rate.
+    //Every CONTROL_RATE samples the modulation and the portamento are advanced by a whole period and the frequency at the end
+    //of the period is calculated. The frequency ramps to it linearly, so that the frequency is calculated only once a period.
+    //Returns true if the frequency should be changed to frequency + frequencyStep.
+    bool ControlPulse()
+    {
+        if (controlCountdown == 0)
+        {
+            if (!ControlPeriod())
+            {
+                frequencyStep = 0;
+                return false;
+            }
+            frequencyStep = (PitchFrequency() - frequency) / CONTROL_RATE;
+            controlCountdown = CONTROL_RATE;
+        }
+        controlCountdown--;
+        return frequencyStep != 0;
+    }
+
+    //Render a block by calling T::TriggerPulse directly, so that there is only one virtual call per block.
+    //The frames after the end of the tone are filled with 0.
+    template<typename T>
+    static bool RenderPulses(T* tone, SampleType* left, SampleType* right, size_t frames)
+    {
+        double gl, gr;
+        for (size_t i = 0; i < frames; i++)
+        {
+            if (tone->T::TriggerPulse(gl, gr))
+            {
+                left[i] = static_cast<SampleType>(gl);
+                right[i] = static_cast<SampleType>(gr);
+            }
+            else
+            {
+                for (; i < frames; i++)
+                    left[i] = right[i] = 0;
+                return false;
+            }
+        }
+        return true;
+    }
+    //Get one pulse by rendering a block of one frame, for the tones that render whole blocks.
+    bool RenderPulse(double& gl, double& gr)
+    {
+        SampleType left, right;
+        bool playing = RenderBlock(&left, &right, 1);
+        gl = left;
+        gr = right;
+        return playing;
     }
 public:
     double GetPitch() const { return pitch; }
@@ -99,6 +220,8 @@ public:
         portamentoPitchDiff = fromPitch - pitch;
         portamentoStep = (portamentoPitchDiff < 0 ? PORTAMENTO_SPEED_CONST : -PORTAMENTO_SPEED_CONST) / (SAMPLE_RATE * 0.2 * portamentoTime / 127 + 1); //
         portamentoEnable = (portamentoPitchDiff != 0);
+        //Start from the pitch the portamento comes from.
+        ReCalibrateFrequency();
     }
 
     uint8_t GetVelocity() const { return velocity; }
@@ -120,25 +243,20 @@ public:
 
     const int GetModulationDepth() const { return modulationDepth; }
     const int GetModulationSpeed() const { return modulationSpeed; }
+    //The modulation is advanced by ControlPeriod, a control period at a time.
     virtual void SetModulation(const int depth, const int speed)
     {
         modulationDepth = depth; 
         modulationSpeed = speed;
         if (modulationDepth == 0)
         {
+            if (modulationBend != 0)
+                pitchChanged = true;
             modulationBend = 0;
             modulationPitchChangePerSample = 0;
         }
         else
-        {
             modulationPitchChangePerSample = (static_cast<double>(modulationDepth) + 1) / 128 * 4 * (128 - static_cast<double>(modulationSpeed)) / 128 * MAX_MODULATION_FREQ / SAMPLE_RATE;
-            modulationBend += modulationPitchChangePerSample * modulationDirection;
-            if (modulationBend > static_cast<double>(modulationDepth) / (128 / MAX_MODULATION_PITCH))
-                modulationDirection = -1;
-            else if (modulationBend < -static_cast<double>(modulationDepth) / (128 / MAX_MODULATION_PITCH))
-                modulationDirection = 1;
-            ReCalibrateFrequency();
-        }
     }
 
     bool GetAutoStereo() const { return autoStereo; }
@@ -184,6 +302,9 @@ public:
         modulationDirection = copy.modulationDirection;
         portamentoEnable = copy.portamentoEnable;
         portamentoPitchDiff = copy.portamentoPitchDiff;
+        controlCountdown = copy.controlCountdown;
+        frequencyStep = copy.frequencyStep;
+        pitchChanged = copy.pitchChanged;
     }
 
     Tone& operator = (const Tone& copy)
@@ -206,6 +327,9 @@ public:
         modulationDirection = copy.modulationDirection;
         portamentoEnable = copy.portamentoEnable;
         portamentoPitchDiff = copy.portamentoPitchDiff;
+        controlCountdown = copy.controlCountdown;
+        frequencyStep = copy.frequencyStep;
+        pitchChanged = copy.pitchChanged;
         return *this;
     }
 
@@ -231,10 +355,18 @@ public:
         SetPitch(_pitch);
     }
 
+    virtual ~Tone() {}
+
     //Get one group of data every pulse.
     //gl = Left channel
     //gr = Right channel
     virtual bool TriggerPulse(double& gl, double& gr) = 0;
+    //Get a block of data. left and right are overwritten with frames of samples.
+    //Returns false if the tone has ended. The rest of the block is filled with 0 then.
+    virtual bool RenderBlock(SampleType* left, SampleType* right, size_t frames) = 0;
+    //Instead of RenderBlock, prepare lane of batch to render the next frames of the tone, for the tones a VoiceBatch can
+    //render. playing is set as RenderBlock returns it. Returns false, doing nothing, if the tone is not rendered in a batch.
+    virtual bool PrepareVoice(VoiceBatch& batch, int lane, size_t frames, bool& playing);
     virtual void ReleaseKey(int velocity)
     {
         releaseVelocity = (128 - velocity) * 32;
@@ -251,7 +383,7 @@ public:
         //The pitch bend wheel value from midi is from 0 to 16383(-8192 to 8191), which means +- one whole tone.
         //The pitchBend value stores -depth to depth, pitch changes one tone every 2 depth value.
         pitchBend = (static_cast<double>(value) - 8192) / 8192 * depth;
-        ReCalibrateFrequency();
+        pitchChanged = true;
     }
 
     virtual void SetFilterCutoffFreq(double freq)
@@ -259,12 +391,64 @@ public:
         lowPassFilter.UpdateParam(freq, SAMPLE_RATE);
     }
 
+    //A resonance of 0 is a resonator at 0Hz, which boosts the bass of the synthetic tones. It is the channel default,
+    //so it runs for every voice. With SetZeroResonanceOff(true) a resonance of 0 is no resonance, and the filter is skipped.
     virtual void SetResonanceFreq(double freq)
     {
-        bandPassFilter.UpdateParam(freq, 200, 1, SAMPLE_RATE);
+        if (freq == 0 && zeroResonanceOff)
+            bandPassFilter.Mute();
+        else
+            bandPassFilter.UpdateParam(freq, 200, 1, SAMPLE_RATE);
+    }
+    static void SetZeroResonanceOff(bool off) { zeroResonanceOff = off; }
+
+    //Build the tables the tones share: the pitch table, the wavetables and the sinc kernels.
+    //Tones read them without checking, so this should be called before the first tone is created. It builds them only once,
+    //so that no tone builds them while rendering. MidiPlayback calls it when it is constructed, WaveformTone::LoadWaveform
+    //before it converts pitches.
+    static void InitializeTables();
+
+    //Create a tone in the pool. Returns nullptr if the pool is exhausted.
+    static Tone* CreateTone(VoicePool& pool, int bank, int GMInstrument, const double _pitch, const uint8_t _velocity = 127);
+};
+
+//Base of the synthetic tones, which read their waves from a band limited Wavetable.
+class WavetableTone : public Tone
+{
+protected:
+    WavetableOscillator oscillator;
+
+    virtual void SetFrequency()
+    {
+        Tone::SetFrequency();
+        oscillator.SetFrequency(frequency);
+    }
+    //The phase is kept by the oscillator, toneSampleCount is not used.
+    virtual void ChangeFrequency(double newFrequency)
+    {
+        frequency = newFrequency;
+        oscillator.SetFrequency(frequency);
     }
+    //Read frames samples of the oscillator, with vibrato, portamento and pitch bend ramped at control rate.
+    void RenderOscillator(double* out, size_t frames);
 
-    static Tone* CreateTone(int bank, int GMInstrument, const double _pitch, const uint8_t _velocity = 127);
+public:
+    //The constructor of Tone calls Tone::SetFrequency, not the one of this class, so the oscillator is set here.
+    WavetableTone(const Wavetable& wavetable) : Tone(), oscillator(wavetable)
+    {
+        oscillator.SetFrequency(frequency);
+    }
+
+    WavetableTone(const Wavetable& wavetable, const double _pitch, const uint8_t _velocity)
+        : Tone(_pitch, _velocity), oscillator(wavetable)
+    {
+        oscillator.SetFrequency(frequency);
+    }
+
+    WavetableTone(const Wavetable& wavetable, const Tone& copy) : Tone(copy), oscillator(wavetable)
+    {
+        oscillator.SetFrequency(frequency);
+    }
 };
 
 class GM001_GrandPiano : public Tone
@@ -272,18 +456,34 @@ class GM001_GrandPiano : public Tone
 protected:
     const double envelopeData[22]{ 100, 80, 60, 40, 30, 25, 23, 21, 19, 17, 16, 13, 10, 8, 8, 6, 6, 5, 4, 3, 2, 0 };
     double lastEvelope; //So that I can do a little fading effect for KeyOff velocity
+    OscillatorBank bank;
 
+    static const OscillatorBank::Spectrum& GetSpectrum();
     bool Envelope(double& g);
-    double ToneGenerator();
+    //Advance the pitch and the envelopes of the partials by a control period.
+    void ControlPoint();
+    virtual void SetFrequency()
+    {
+        Tone::SetFrequency();
+        bank.SetFrequency(frequency);
+    }
+    //The phases are kept by the bank, toneSampleCount is not used.
+    virtual void ChangeFrequency(double newFrequency)
+    {
+        frequency = newFrequency;
+        bank.SetFrequency(frequency);
+    }
 public:
     bool TriggerPulse(double& gl, double& gr);
+    bool RenderBlock(SampleType* left, SampleType* right, size_t frames);
  
-    GM001_GrandPiano() : Tone(), lastEvelope(0)
+    //The constructor of Tone calls Tone::SetFrequency, not the one of this class, so the bank is set here.
+    GM001_GrandPiano() : Tone(), lastEvelope(0), bank(GetSpectrum())
     {
-        
+        bank.SetFrequency(frequency);
     }
 
-    GM001_GrandPiano(const GM001_GrandPiano& copy) : Tone(copy)
+    GM001_GrandPiano(const GM001_GrandPiano& copy) : Tone(copy), bank(copy.bank)
     {
         lastEvelope = copy.lastEvelope;
         releaseVelocity = copy.releaseVelocity;
@@ -291,62 +491,67 @@ public:
     GM001_GrandPiano& operator = (const GM001_GrandPiano& copy)
     {
         Tone::operator = (copy);
+        bank = copy.bank;
         releaseVelocity = copy.releaseVelocity;
         return *this;
     }
 
     GM001_GrandPiano(const int _bank, const int _instrumentID, const double _pitch, const uint8_t _velocity = 127)
-        : Tone(_pitch, _velocity), lastEvelope(0)
+        : Tone(_pitch, _velocity), lastEvelope(0), bank(GetSpectrum())
     {
         //bank and instrument id are omitted.
+        bank.SetFrequency(frequency);
     }
 };
 
-class GM080_Square : public Tone
+class GM080_Square : public WavetableTone
 {
 public:
     bool TriggerPulse(double& gl, double& gr);
+    bool RenderBlock(SampleType* left, SampleType* right, size_t frames);
 
-    GM080_Square() : Tone()
+    GM080_Square() : WavetableTone(Wavetable::Square())
     {
     }
 
-    GM080_Square(const GM080_Square& copy) : Tone(copy)
+    GM080_Square(const GM080_Square& copy) : WavetableTone(copy)
     {
     }
     GM080_Square& operator = (const GM080_Square& copy)
     {
-        Tone::operator = (copy);
+        WavetableTone::operator = (copy);
         return *this;
     }
 
     GM080_Square(const int _bank, const int _instrumentID, const double _pitch, const uint8_t _velocity = 127)
-        : Tone(_pitch, _velocity)
+        : WavetableTone(Wavetable::Square(), _pitch, _velocity)
     {
         //bank and instrument id are omitted.
     }
 };
 
-class GM081_Triangle : public Tone
+class GM081_Triangle : public WavetableTone
 {
 public:
     bool TriggerPulse(double& gl, double& gr);
+    bool RenderBlock(SampleType* left, SampleType* right, size_t frames);
 
-    GM081_Triangle() : Tone()
+    GM081_Triangle() : WavetableTone(Wavetable::Triangle())
     {
     }
 
-    GM081_Triangle(const GM080_Square& copy) : Tone(copy)
+    GM081_Triangle(const GM080_Square& copy) : WavetableTone(Wavetable::Triangle(), copy)
     {
     }
     GM081_Triangle& operator = (const GM080_Square& copy)
     {
         Tone::operator = (copy);
+        oscillator.SetFrequency(frequency);
         return *this;
     }
 
     GM081_Triangle(const int _bank, const int _instrumentID, const double _pitch, const uint8_t _velocity = 127)
-        : Tone(_pitch, _velocity)
+        : WavetableTone(Wavetable::Triangle(), _pitch, _velocity)
     {
         //bank and instrument id are omitted.
     }
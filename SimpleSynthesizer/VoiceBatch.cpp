@@ -0,0 +1,205 @@
+/*
+	SimpleSynthesizer V0.2
+	Sample voices rendered together.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "Interpolation.h"
+#include "VoiceBatch.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+constexpr double FRACTION_SCALE = 1 / PHASE_ONE;
+
+#if defined(__AVX2__)
+
+//Transpose 4 vectors of 4 64 bit values.
+static inline void Transpose(__m256d* rows)
+{
+	__m256d t0 = _mm256_unpacklo_pd(rows[0], rows[1]);
+	__m256d t1 = _mm256_unpackhi_pd(rows[0], rows[1]);
+	__m256d t2 = _mm256_unpacklo_pd(rows[2], rows[3]);
+	__m256d t3 = _mm256_unpackhi_pd(rows[2], rows[3]);
+	rows[0] = _mm256_permute2f128_pd(t0, t2, 0x20);
+	rows[1] = _mm256_permute2f128_pd(t1, t3, 0x20);
+	rows[2] = _mm256_permute2f128_pd(t0, t2, 0x31);
+	rows[3] = _mm256_permute2f128_pd(t1, t3, 0x31);
+}
+
+//The samples of 4 frames of the lanes are interpolated at once: the phases of 4 frames of each lane are loaded and
+//transposed, so that a vector holds one frame of every lane, and the samples are transposed back to the lanes.
+void VoiceBatch::Render(int lanes, size_t frames)
+{
+	//The unused lanes play nothing and read nothing.
+	int64_t address[VOICE_BATCH_LANES];
+	int64_t shift[VOICE_BATCH_LANES];
+	int active[VOICE_BATCH_LANES];
+	int stereo[VOICE_BATCH_LANES];
+	bool released = false;
+	bool anyStereo = false;
+	for (int lane = 0; lane < VOICE_BATCH_LANES; lane++)
+	{
+		bool used = lane < lanes;
+		address[lane] = used ? reinterpret_cast<int64_t>(data[lane]) : 0;
+		shift[lane] = used && channels[lane] == 2 ? 2 : 1;		//Bytes of a frame, as a shift.
+		active[lane] = used ? count[lane] : 0;
+		stereo[lane] = used && channels[lane] == 2 ? -1 : 0;
+		released = released || (used && envelopeStep[lane] != 0);
+		anyStereo = anyStereo || stereo[lane] != 0;
+	}
+	const __m256i addressV = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(address));
+	const __m256i shiftV = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(shift));
+	const __m128i activeV = _mm_loadu_si128(reinterpret_cast<const __m128i*>(active));
+	const __m128i stereoV = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stereo));
+	const __m256i fractionMask = _mm256_set1_epi64x(static_cast<int64_t>(PHASE_FRACTION_MASK));
+	//A fraction of 32 bits put under the exponent of 2^52 is converted exactly by subtracting 2^52 again.
+	const __m256i exponent = _mm256_set1_epi64x(0x4330000000000000);
+	const __m256d two52 = _mm256_set1_pd(4503599627370496.0);
+	const __m256d fractionScale = _mm256_set1_pd(FRACTION_SCALE);
+	const __m256d one = _mm256_set1_pd(1);
+	//The soft pedal halves the volume, which is exact, so soft and volume are one gain.
+	const __m256d gainV = _mm256_mul_pd(_mm256_loadu_pd(soft), _mm256_loadu_pd(volume));
+	const __m256d envelopeStepV = _mm256_loadu_pd(envelopeStep);
+	const __m256d envelopeScaleV = _mm256_loadu_pd(envelopeScale);
+	__m256d envelopeV = _mm256_loadu_pd(envelope);
+
+	for (size_t start = 0; start < frames; start += 4)
+	{
+		//Frames to lanes.
+		__m256d phaseBits[4];
+		for (int lane = 0; lane < VOICE_BATCH_LANES; lane++)
+			phaseBits[lane] = _mm256_load_pd(reinterpret_cast<const double*>(&phases[lane][start]));
+		Transpose(phaseBits);
+		__m256i phase[4];
+		for (int n = 0; n < 4; n++)
+			phase[n] = _mm256_castpd_si256(phaseBits[n]);
+
+#if (USE_FLOAT_ENGINE)
+		__m128 outLeft[4];
+		__m128 outRight[4];
+#else
+		__m256d outLeft[4];
+		__m256d outRight[4];
+#endif
+		for (int n = 0; n < 4; n++)
+		{
+			const __m128i playing = _mm_cmpgt_epi32(activeV, _mm_set1_epi32(static_cast<int>(start) + n));
+			//The frame at the position, and the next one. A mono frame and the next one are read at once.
+			const __m256i frame = _mm256_add_epi64(addressV, _mm256_sllv_epi64(_mm256_srli_epi64(phase[n], PHASE_FRACTION_BITS), shiftV));
+			const __m128i first = _mm256_mask_i64gather_epi32(_mm_setzero_si128(), static_cast<const int*>(nullptr), frame, playing, 1);
+			__m128i second = _mm_setzero_si128();
+			if (anyStereo)
+				second = _mm256_mask_i64gather_epi32(second, static_cast<const int*>(nullptr), _mm256_add_epi64(frame, _mm256_set1_epi64x(4)), _mm_and_si128(playing, stereoV), 1);
+			const __m128i firstLow = _mm_srai_epi32(_mm_slli_epi32(first, 16), 16);
+			const __m128i firstHigh = _mm_srai_epi32(first, 16);
+			const __m128i secondLow = _mm_srai_epi32(_mm_slli_epi32(second, 16), 16);
+			const __m128i secondHigh = _mm_srai_epi32(second, 16);
+			//A mono voice plays the same samples on both sides.
+			const __m256d left0 = _mm256_cvtepi32_pd(firstLow);
+			const __m256d left1 = _mm256_cvtepi32_pd(_mm_blendv_epi8(firstHigh, secondLow, stereoV));
+			const __m256d right0 = _mm256_cvtepi32_pd(_mm_blendv_epi8(firstLow, firstHigh, stereoV));
+			const __m256d right1 = _mm256_cvtepi32_pd(_mm_blendv_epi8(firstHigh, secondHigh, stereoV));
+
+			const __m256d fraction = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(phase[n], fractionMask), exponent)), two52);
+			const __m256d linear = _mm256_mul_pd(fraction, fractionScale);
+			const __m256d rest = _mm256_sub_pd(one, linear);
+			//The same operations as for a single voice, so that the samples are the same.
+			//An envelope of 1 leaves them as they are.
+			const __m256d mask = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(playing));
+			__m256d gl = _mm256_add_pd(_mm256_mul_pd(left0, rest), _mm256_mul_pd(left1, linear));
+			__m256d gr = _mm256_add_pd(_mm256_mul_pd(right0, rest), _mm256_mul_pd(right1, linear));
+			gl = _mm256_mul_pd(gl, gainV);
+			gr = _mm256_mul_pd(gr, gainV);
+			if (released)
+			{
+				const __m256d gain = _mm256_div_pd(envelopeV, envelopeScaleV);
+				gl = _mm256_mul_pd(gl, gain);
+				gr = _mm256_mul_pd(gr, gain);
+				envelopeV = _mm256_sub_pd(envelopeV, envelopeStepV);
+			}
+#if (USE_FLOAT_ENGINE)
+			outLeft[n] = _mm256_cvtpd_ps(_mm256_and_pd(gl, mask));
+			outRight[n] = _mm256_cvtpd_ps(_mm256_and_pd(gr, mask));
+#else
+			outLeft[n] = _mm256_and_pd(gl, mask);
+			outRight[n] = _mm256_and_pd(gr, mask);
+#endif
+		}
+		//Lanes to frames.
+#if (USE_FLOAT_ENGINE)
+		_MM_TRANSPOSE4_PS(outLeft[0], outLeft[1], outLeft[2], outLeft[3]);
+		_MM_TRANSPOSE4_PS(outRight[0], outRight[1], outRight[2], outRight[3]);
+		for (int lane = 0; lane < lanes; lane++)
+		{
+			_mm_store_ps(&left[lane][start], outLeft[lane]);
+			_mm_store_ps(&right[lane][start], outRight[lane]);
+		}
+#else
+		Transpose(outLeft);
+		Transpose(outRight);
+		for (int lane = 0; lane < lanes; lane++)
+		{
+			_mm256_store_pd(&left[lane][start], outLeft[lane]);
+			_mm256_store_pd(&right[lane][start], outRight[lane]);
+		}
+#endif
+	}
+}
+
+#else
+
+//Each lane is rendered alone, by a loop built for its channels and its envelope.
+template<int CHANNELS, bool RELEASED>
+static void RenderLane(const int16_t* data, const uint64_t* phases, SampleType* left, SampleType* right, size_t count,
+	double gain, double envelope, double envelopeStep, double envelopeScale)
+{
+	for (size_t n = 0; n < count; n++)
+	{
+		const int16_t* frame = data + (phases[n] >> PHASE_FRACTION_BITS) * CHANNELS;
+		double linear = (phases[n] & PHASE_FRACTION_MASK) * FRACTION_SCALE;
+		double gl = frame[0] * (1 - linear) + frame[CHANNELS] * linear;
+		double gr = CHANNELS == 2 ? frame[1] * (1 - linear) + frame[CHANNELS + 1] * linear : gl;
+		//The same operations as for a single voice, so that the samples are the same. The soft pedal halves the
+		//volume, which is exact, so soft and volume are one gain.
+		gl *= gain;
+		gr *= gain;
+		if (RELEASED)
+		{
+			double envelopeGain = envelope / envelopeScale;
+			gl *= envelopeGain;
+			gr *= envelopeGain;
+			envelope -= envelopeStep;
+		}
+		left[n] = static_cast<SampleType>(gl);
+		right[n] = static_cast<SampleType>(gr);
+	}
+}
+
+void VoiceBatch::Render(int lanes, size_t frames)
+{
+	for (int lane = 0; lane < lanes; lane++)
+	{
+		const size_t played = static_cast<size_t>(count[lane]) < frames ? static_cast<size_t>(count[lane]) : frames;
+		const bool released = envelopeStep[lane] != 0;
+		auto render = channels[lane] == 2 ? (released ? RenderLane<2, true> : RenderLane<2, false>) : (released ? RenderLane<1, true> : RenderLane<1, false>);
+		render(data[lane], phases[lane], left[lane], right[lane], played, soft[lane] * volume[lane], envelope[lane], envelopeStep[lane], envelopeScale[lane]);
+		for (size_t n = played; n < frames; n++)
+			left[lane][n] = right[lane][n] = 0;
+	}
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+	SimpleSynthesizer V0.2
+	Sample voices rendered together.
+	A channel playing a dense chord renders many voices of the same kind one after another, each looking up its own
+	waveform and reading its own samples. The voices of a batch are kept as a structure of arrays instead: the sample
+	data, the positions and the gains of each voice in a lane of its own, so that the kernel interpolates the samples of
+	all the lanes at once. Built with AVX2 (USE_AVX2 in CMake), the samples of the lanes are read with gathers.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "Tone.h"
+
+constexpr int VOICE_BATCH_LANES = 4;					//Voices rendered at once, one in each double of a 256 bit vector.
+constexpr size_t VOICE_BATCH_FRAMES = TONE_CHUNK_SIZE;	//Frames rendered at once.
+
+class VoiceBatch
+{
+public:
+	//Of each lane, set by Tone::PrepareVoice. The frames after count are silent.
+	const int16_t* data[VOICE_BATCH_LANES]{};	//1 or 2 interleaved channels, see WaveformTone::WaveformType.
+	int channels[VOICE_BATCH_LANES]{};
+	int count[VOICE_BATCH_LANES]{};
+	double soft[VOICE_BATCH_LANES]{};			//0.5, or 1 if the soft pedal is up.
+	double volume[VOICE_BATCH_LANES]{};
+	//The release envelope is envelope / envelopeScale, and envelope decreases by envelopeStep every frame.
+	//Released voices count down the frames of their release, the others have an envelope of 1 and no step.
+	double envelope[VOICE_BATCH_LANES]{};
+	double envelopeStep[VOICE_BATCH_LANES]{};
+	double envelopeScale[VOICE_BATCH_LANES]{};
+	//The position of every frame, fixed point like WaveformTone::phase. Each can be interpolated linearly.
+	alignas(32) uint64_t phases[VOICE_BATCH_LANES][VOICE_BATCH_FRAMES]{};
+
+	//Output of each lane.
+	alignas(32) SampleType left[VOICE_BATCH_LANES][VOICE_BATCH_FRAMES]{};
+	alignas(32) SampleType right[VOICE_BATCH_LANES][VOICE_BATCH_FRAMES]{};
+
+	//Render frames of the first lanes to left and right, by linear interpolation. The samples are the same as
+	//WaveformTone::RenderBlock renders for each voice.
+	void Render(int lanes, size_t frames);
+};
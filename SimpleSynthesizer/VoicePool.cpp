@@ -0,0 +1,34 @@
+/*
+	SimpleSynthesizer V0.2
+	Fixed capacity pool of tones.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "VoicePool.h"
+
+void VoicePool::Reserve(size_t count)
+{
+	if (count == capacity)
+		return;
+
+	capacity = count;
+	slots.reset(count > 0 ? new Slot[count] : nullptr);
+	freeSlots.clear();
+	freeSlots.reserve(count);
+	//Hand out the first slots first.
+	for (size_t i = count; i > 0; i--)
+		freeSlots.push_back(&slots[i - 1]);
+}
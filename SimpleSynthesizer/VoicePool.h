@@ -0,0 +1,75 @@
+/*
+	SimpleSynthesizer V0.2
+	Fixed capacity pool of tones.
+	Every slot is big enough for any kind of tone, so that a note on takes a free slot and constructs the tone in place,
+	and a tone that has ended gives its slot back. Both are O(1) and never touch the heap.
+	The slots are allocated when a midi file is loaded.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include "Tone.h"
+#include "WaveformTone.h"
+
+//Size and alignment of a slot: the largest of all kinds of tones.
+constexpr size_t VOICE_SLOT_SIZE = std::max({ sizeof(WaveformTone), sizeof(GM001_GrandPiano), sizeof(GM080_Square), sizeof(GM081_Triangle) });
+constexpr size_t VOICE_SLOT_ALIGN = std::max({ alignof(WaveformTone), alignof(GM001_GrandPiano), alignof(GM080_Square), alignof(GM081_Triangle) });
+
+class VoicePool
+{
+protected:
+	struct alignas(VOICE_SLOT_ALIGN) Slot
+	{
+		unsigned char data[VOICE_SLOT_SIZE];
+	};
+
+	std::unique_ptr<Slot[]> slots;
+	std::vector<Slot*> freeSlots;	//Used as a stack. Its capacity is reserved, pushing never allocates.
+	size_t capacity{ 0 };
+
+public:
+	//Allocate count slots. All tones of the pool should have been destroyed.
+	void Reserve(size_t count);
+
+	size_t GetCapacity() const { return capacity; }
+	size_t GetFree() const { return freeSlots.size(); }
+
+	//Construct a tone in a free slot. Returns nullptr if the pool is exhausted.
+	template<class T, class... Args>
+	T* Create(Args&&... args)
+	{
+		static_assert(sizeof(T) <= VOICE_SLOT_SIZE && alignof(T) <= VOICE_SLOT_ALIGN, "Add the tone to VOICE_SLOT_SIZE.");
+		if (freeSlots.empty())
+			return nullptr;
+		Slot* slot = freeSlots.back();
+		freeSlots.pop_back();
+		return new (slot->data) T(std::forward<Args>(args)...);
+	}
+
+	//Destroy a tone created by this pool and give its slot back.
+	void Destroy(Tone* tone)
+	{
+		void* memory = dynamic_cast<void*>(tone);	//The most derived object, which is where the slot starts.
+		tone->~Tone();
+		freeSlots.push_back(static_cast<Slot*>(memory));
+	}
+};
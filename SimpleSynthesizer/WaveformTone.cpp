@@ -22,14 +22,42 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
-#include <io.h>
 #include <stdlib.h>
+#include <string>
+#include <algorithm>
+#include <filesystem>
 #include "Tone.h"
 #include "WaveformTone.h"
+#include "MappedFile.h"
+#include "PackedBank.h"
+#include "SampleStreamer.h"
+#include "VoiceBatch.h"
 
 //Static members of WaveformTone
 std::vector<WaveformTone::WaveformType> WaveformTone::waveForms;
 std::vector<WaveformTone::InstrumentInfo> WaveformTone::instrumentInfos;
+std::string WaveformTone::waveformPath{ "Waveform" };
+InterpolationQuality WaveformTone::interpolation{ InterpolationQuality::Linear };
+WaveformLoading WaveformTone::loading{ WaveformLoading::Map };
+double WaveformTone::streamHeadMilliseconds{ 200 };
+double WaveformTone::streamLookaheadMilliseconds{ 500 };
+bool WaveformTone::streamHold{ true };
+//The packed bank at waveformPath, opened by the first LoadWaveform.
+static PackedBank packedBank;
+//Defined after waveForms, so that it stops before the waveforms are freed at exit.
+static SampleStreamer streamer;
+
+//When streaming, read the head of a mapped waveform as it is loaded.
+static void LoadStreamHead(const WaveformTone::WaveformType& waveForm)
+{
+	if (WaveformTone::loading != WaveformLoading::Stream || waveForm.mapping == nullptr)
+		return;
+	streamer.Start();
+	size_t frameBytes = waveForm.channels * sizeof(int16_t);
+	size_t frames = (std::min)(static_cast<size_t>(WaveformTone::streamHeadMilliseconds * SAMPLE_RATE / 1000), waveForm.size);
+	size_t offset = reinterpret_cast<const uint8_t*>(waveForm.data) - waveForm.mapping->GetData();
+	streamer.LoadHead(waveForm.mapping.get(), offset, frames * frameBytes);
+}
 //---------------------------------------
 
 
@@ -230,6 +258,9 @@ bool WaveformTone::LoadWaveform(int bank, int instrumentID)
 	//    F, T: from F pitch to T pitch, use this sample file.
 	//    L: L part is optional. L == 1 means there is a loop part in the sample. L == 2 means always sustain(play the whole wave file without responding to NoteOff)
 
+	//The base frequencies are converted by the pitch table, also when a bank is packed without a MidiPlayback.
+	Tone::InitializeTables();
+
 	//-------------------
 	//Not a full GM bank.
 	if (bank == 0)
@@ -245,10 +276,40 @@ bool WaveformTone::LoadWaveform(int bank, int instrumentID)
 		if (tone.bank == bank && tone.instrumentID == instrumentID)
 			return true;
 	}
+
+	//A packed bank is mapped once. An instrument is looked up in its index, no file is read or parsed.
+	std::error_code fileError;
+	if (packedBank.IsOpen() || std::filesystem::is_regular_file(waveformPath, fileError))
+	{
+		if (!packedBank.IsOpen() && !packedBank.Open(waveformPath, loading == WaveformLoading::Prefetch))
+			return false;
+		auto range = packedBank.Find(bank, instrumentID);
+		for (const PackedWaveform* entry = range.first; entry != range.second; entry++)
+		{
+			WaveformType waveForm{ entry->bank,
+									entry->instrumentID,
+									entry->pitch,
+									entry->pitchFrom,
+									entry->pitchTo,
+									entry->frequencyBase,
+									entry->loop != 0,
+									entry->alwaysSustain != 0,
+									entry->loopStartAt,
+									entry->loopEndAt,
+									static_cast<size_t>(entry->size),
+									entry->channels,
+									packedBank.GetData(*entry),
+									packedBank.GetFile()
+			};
+			LoadStreamHead(waveForm);
+			waveForms.push_back(waveForm);
+		}
+		return range.first != range.second;
+	}
+
 	try
 	{
-		char dir[_MAX_PATH];
-		sprintf_s(dir, ".\\Waveform\\Bank%d\\%d\\*.*", bank, instrumentID);
+		std::filesystem::path dir = std::filesystem::path(waveformPath) / ("Bank" + std::to_string(bank)) / std::to_string(instrumentID);
 
 		//Walk the directory and search for a proper sample file.
 		//Matches pitch first. If no pitch matches perfectly, try matching a range.
@@ -257,178 +318,211 @@ bool WaveformTone::LoadWaveform(int bank, int instrumentID)
 		int namePitchTo{ -1 };
 		bool nameLoop{ false };
 		bool nameAlwaysSutain{ false };
-		_finddata_t dirInfo;
-		long dirHandle = _findfirst(dir, &dirInfo);
-		if (dirHandle == -1)
+		std::error_code error;
+		std::vector<std::string> fileNames;
+		for (std::filesystem::directory_iterator it(dir, error), end; !error && it != end; it.increment(error))
+		{
+			if (it->is_regular_file(error))
+				fileNames.push_back(it->path().filename().string());
+		}
+		if (error)
 			throw 0;	//Error reading directory.
-		do
+		//Walk in name order, whatever order the file system lists them.
+		std::sort(fileNames.begin(), fileNames.end());
+		for (auto& fileName : fileNames)
 		{
-			if ((dirInfo.attrib & _A_SUBDIR) == 0 && (dirInfo.attrib & _A_SYSTEM) == 0)
+			const char* name = fileName.c_str();
+			//split the file name into 3 parts.
+			int pos = 0;
+			namePitch = atoi(name);
+			while (name[pos] != '_' && name[pos] != '\0')
+				pos++;
+			if (name[pos] == '_')
 			{
-				//split the file name into 3 parts.
-				int pos = 0;
-				namePitch = atoi(dirInfo.name);
-				while (dirInfo.name[pos] != '_' && dirInfo.name[pos] != NULL)
-					pos++;
-				if (dirInfo.name[pos] == '_')
-				{
-					pos++;
-					namePitchFrom = atoi(dirInfo.name + pos);
-				}
-				while (dirInfo.name[pos] != '_' && dirInfo.name[pos] != NULL)
-					pos++;
-				if (dirInfo.name[pos] == '_')
-				{
-					pos++;
-					namePitchTo = atoi(dirInfo.name + pos);
-				}
-				while (dirInfo.name[pos] != '_' && dirInfo.name[pos] != NULL)
-					pos++;
-				if (dirInfo.name[pos] == '_')
-				{
-					nameLoop = (dirInfo.name[pos + 1] == '1');
-					nameAlwaysSutain = (dirInfo.name[pos + 1] == '2');
-				}
+				pos++;
+				namePitchFrom = atoi(name + pos);
+			}
+			while (name[pos] != '_' && name[pos] != '\0')
+				pos++;
+			if (name[pos] == '_')
+			{
+				pos++;
+				namePitchTo = atoi(name + pos);
+			}
+			while (name[pos] != '_' && name[pos] != '\0')
+				pos++;
+			if (name[pos] == '_')
+			{
+				nameLoop = (name[pos + 1] == '1');
+				nameAlwaysSutain = (name[pos + 1] == '2');
+			}
 
-				if (namePitch != 0)
+			if (namePitch != 0)
+			{
+				WaveformType waveForm{ bank,
+										instrumentID,
+										static_cast<double>(namePitch),
+										static_cast<double>(namePitchFrom),
+										static_cast<double>(namePitchTo),
+										PitchTable::PitchToFrequency(namePitch),
+										nameLoop,
+										nameAlwaysSutain,
+										0,
+										0,
+										0,
+										1,
+										nullptr,
+										nullptr
+				};
+
+				std::ifstream file;
+				file.open(dir / fileName, std::ios::in | std::ios::binary);
+
+				size_t length = 0;	//Length of wave data
+
+				//see if it is an RIFF wave file
+				RIFFHeader riffHeader{};
+				WaveFormat waveFormat{};
+				WaveDataHeader waveDataHeader{};
+				file.read((char*)&riffHeader, sizeof(RIFFHeader));
+				if (riffHeader.id == 0x46464952 && riffHeader.type == 0x45564157)	//id == "RIFF" and type == "WAVE"
 				{
-					sprintf_s(dir, ".\\Waveform\\Bank%d\\%d\\%s", bank, instrumentID, dirInfo.name);
-
-					WaveformType waveForm{ bank,
-											instrumentID,
-											static_cast<double>(namePitch),
-											static_cast<double>(namePitchFrom),
-											static_cast<double>(namePitchTo),
-											440 * pow(2, (namePitch - 69) / 12),
-											nameLoop,
-											nameAlwaysSutain,
-											0,
-											0,
-											0,
-											nullptr, nullptr
-					};
-
-					std::ifstream file;
-					file.open(dir, std::ios::in | std::ios::binary);
-
-					size_t length = 0;	//Length of wave data
-
-					//see if it is an RIFF wave file
-					RIFFHeader riffHeader{};
-					WaveFormat waveFormat{};
-					WaveDataHeader waveDataHeader{};
-					file.read((char*)&riffHeader, sizeof(RIFFHeader));
-					if (riffHeader.id == 0x46464952 && riffHeader.type == 0x45564157)	//id == "RIFF" and type == "WAVE"
+					//RIFF file.
+					//Read wave format chunck.
+					file.read((char*)&waveFormat, sizeof(WaveFormat));
+					//id == "fmt ", audioFormat == PCM, sample rate should be 44100, 16 bits per sample, 2 channels stereo.
+					//Other formats are not supported.
+					if (waveFormat.id == 0x20746d66 && waveFormat.audioFormat == 1 && waveFormat.sampleRate == 44100 && waveFormat.bitsPerSample == 16)// && waveFormat.numChannels == 2)
 					{
-						//RIFF file.
-						//Read wave format chunck.
-						file.read((char*)&waveFormat, sizeof(WaveFormat));
-						//id == "fmt ", audioFormat == PCM, sample rate should be 44100, 16 bits per sample, 2 channels stereo.
-						//Other formats are not supported.
-						if (waveFormat.id == 0x20746d66 && waveFormat.audioFormat == 1 && waveFormat.sampleRate == 44100 && waveFormat.bitsPerSample == 16)// && waveFormat.numChannels == 2)
+						//In case this chunk has a larger size than sizeof(WaveFormat).
+						waveFormat.size -= sizeof(WaveFormat) - sizeof(waveFormat.id) - sizeof(waveFormat.size);
+						if (waveFormat.size > 0)
+							file.seekg(waveFormat.size, std::ios::cur);
+
+						//Trying reading data header
+						file.read((char*)&waveDataHeader, sizeof(WaveDataHeader));
+						if (waveDataHeader.id == 0x61746164)	//id == "data"?
+							length = waveDataHeader.size / (waveFormat.bitsPerSample / 8) / waveFormat.numChannels;
+						else if (waveDataHeader.id == 0x74636166)	//If it's a "fact" chunk
 						{
-							//In case this chunk has a larger size than sizeof(WaveFormat).
-							waveFormat.size -= sizeof(WaveFormat) - sizeof(waveFormat.id) - sizeof(waveFormat.size);
-							if (waveFormat.size > 0)
-								file.seekg(waveFormat.size, std::ios::cur);
-
-							//Trying reading data header
+							if (waveDataHeader.size > 0)
+								file.seekg(waveDataHeader.size, std::ios::cur);
+							//Try again
 							file.read((char*)&waveDataHeader, sizeof(WaveDataHeader));
-							if (waveDataHeader.id == 0x61746164)	//id == "data"?
+							if (waveDataHeader.id == 0x61746164)
 								length = waveDataHeader.size / (waveFormat.bitsPerSample / 8) / waveFormat.numChannels;
-							else if (waveDataHeader.id == 0x74636166)	//If it's a "fact" chunk
-							{
-								if (waveDataHeader.size > 0)
-									file.seekg(waveDataHeader.size, std::ios::cur);
-								//Try again
-								file.read((char*)&waveDataHeader, sizeof(WaveDataHeader));
-								if (waveDataHeader.id == 0x61746164)
-									length = waveDataHeader.size / (waveFormat.bitsPerSample / 8) / waveFormat.numChannels;
-								else
-									throw 0;	//Invalid format
-							}
 							else
-								throw 0;	//Invalid format.
+								throw 0;	//Invalid format
 						}
+						else
+							throw 0;	//Invalid format.
 					}
-					else
-					{
-						//Not an RIFF wave file.
-						//Interpret it as a raw PCM sample file.
-						file.seekg(0, std::ios::end);
-						length = static_cast<size_t>(file.tellg() / sizeof(int16_t) / 2);
-						file.seekg(0, std::ios::beg);
-					}
+				}
+				else
+				{
+					//Not an RIFF wave file.
+					//Interpret it as a raw PCM sample file.
+					file.seekg(0, std::ios::end);
+					length = static_cast<size_t>(file.tellg() / sizeof(int16_t) / 2);
+					file.seekg(0, std::ios::beg);
+				}
 
-					waveForm.size = length;
-					if (length > 0)
+				waveForm.size = length;
+				if (length > 0)
+				{
+					//The frames are stored in the file as they are kept in memory.
+					waveForm.channels = waveFormat.numChannels == 2 ? 2 : 1;
+					size_t bytes = length * waveForm.channels * sizeof(int16_t);
+					size_t offset = static_cast<size_t>(file.tellg());
+					//So data can point straight into the mapped file, if the samples are aligned and all in the file.
+					//A stereo file with identical channels is not checked, that would read all of it.
+					if (loading != WaveformLoading::Read && offset % sizeof(int16_t) == 0)
 					{
-						waveForm.leftChannel = new int16_t[length];
-						waveForm.rightChannel = new int16_t[length];
-
-						for (size_t i = 0; i < length; i++)
+						std::shared_ptr<MappedFile> mapping = std::make_shared<MappedFile>();
+						if (mapping->Open(dir / fileName, loading == WaveformLoading::Prefetch) && offset + bytes <= mapping->GetSize())
 						{
-							file.read((char*)&(waveForm.leftChannel[i]), sizeof(int16_t));
-							if (waveFormat.numChannels == 2)
-								file.read((char*)&(waveForm.rightChannel[i]), sizeof(int16_t));
-							else
-								waveForm.rightChannel[i] = waveForm.leftChannel[i];
+							waveForm.mapping = mapping;
+							waveForm.data = reinterpret_cast<const int16_t*>(mapping->GetData() + offset);
+							LoadStreamHead(waveForm);
 						}
 					}
 
-					file.close();
-
-					//If it is a loop, find out the start and end position of the loop
-					if (waveForm.loop)
+					if (waveForm.mapping == nullptr)
 					{
-						size_t pos = waveForm.size - 1;
-						size_t posMin = pos;
-						int16_t left = waveForm.leftChannel[pos];
-						int cyclePointsCount = static_cast<int>(SAMPLE_RATE / waveForm.frequencyBase) * 2;
-						//back to a lowest point
-						while (cyclePointsCount > 0)
+						int16_t* data = new int16_t[length * waveForm.channels]();
+						file.read((char*)data, bytes);
+						waveForm.data = data;
+
+						//A stereo file with the same samples in both channels is kept once.
+						if (waveForm.channels == 2)
 						{
-							if (waveForm.leftChannel[pos] < left)
+							size_t i = 0;
+							while (i < length && data[i * 2] == data[i * 2 + 1])
+								i++;
+							if (i == length)
 							{
-								posMin = pos;
-								left = waveForm.leftChannel[pos];
+								int16_t* mono = new int16_t[length];
+								for (i = 0; i < length; i++)
+									mono[i] = data[i * 2];
+								delete[] data;
+								waveForm.data = mono;
+								waveForm.channels = 1;
 							}
-							pos--;
-							cyclePointsCount--;
 						}
-						pos = posMin;
-						//then, still go back, find the nearest zero point
-						while (pos > 0 && waveForm.leftChannel[pos] < 0)
+					}
+				}
+
+				file.close();
+
+				//If it is a loop, find out the start and end position of the loop
+				if (waveForm.loop)
+				{
+					size_t pos = waveForm.size - 1;
+					size_t posMin = pos;
+					int16_t left = waveForm.Left(pos);
+					int cyclePointsCount = static_cast<int>(SAMPLE_RATE / waveForm.frequencyBase) * 2;
+					//back to a lowest point
+					while (cyclePointsCount > 0)
+					{
+						if (waveForm.Left(pos) < left)
 						{
-							pos--;
+							posMin = pos;
+							left = waveForm.Left(pos);
 						}
+						pos--;
+						cyclePointsCount--;
+					}
+					pos = posMin;
+					//then, still go back, find the nearest zero point
+					while (pos > 0 && waveForm.Left(pos) < 0)
+					{
+						pos--;
+					}
+					//Linear
+					waveForm.loopEndAt = pos + static_cast<double>(waveForm.Left(pos)) / (static_cast<double>(waveForm.Left(pos)) - waveForm.Left(pos + 1));
+					//back some cycles
+					size_t spos = static_cast<size_t>(waveForm.loopEndAt - SAMPLE_RATE / waveForm.frequencyBase * 200);
+					//find the precise start position
+					//and, it measures the actual frequency
+					if (waveForm.Left(spos) > 0)
+					{
+						while (waveForm.Left(spos) > 0)
+							spos++;
 						//Linear
-						waveForm.loopEndAt = pos + static_cast<double>(waveForm.leftChannel[pos]) / (static_cast<double>(waveForm.leftChannel[pos]) - waveForm.leftChannel[pos + 1]);
-						//back some cycles
-						size_t spos = static_cast<size_t>(waveForm.loopEndAt - SAMPLE_RATE / waveForm.frequencyBase * 200);
-						//find the precise start position
-						//and, it measures the actual frequency
-						if (waveForm.leftChannel[spos] > 0)
-						{
-							while (waveForm.leftChannel[spos] > 0)
-								spos++;
-							//Linear
-							waveForm.loopStartAt = spos - static_cast<double>(-waveForm.leftChannel[spos]) / (-static_cast<double>(waveForm.leftChannel[spos]) + waveForm.leftChannel[spos - 1]);
-						}
-						else
-						{
-							while (spos > 0 && waveForm.leftChannel[spos] < 0)
-								spos--;
-							//Linear
-							waveForm.loopStartAt = spos + static_cast<double>(waveForm.leftChannel[spos]) / (static_cast<double>(waveForm.leftChannel[spos]) - waveForm.leftChannel[spos + 1]);
-						}
+						waveForm.loopStartAt = spos - static_cast<double>(-waveForm.Left(spos)) / (-static_cast<double>(waveForm.Left(spos)) + waveForm.Left(spos - 1));
+					}
+					else
+					{
+						while (spos > 0 && waveForm.Left(spos) < 0)
+							spos--;
+						//Linear
+						waveForm.loopStartAt = spos + static_cast<double>(waveForm.Left(spos)) / (static_cast<double>(waveForm.Left(spos)) - waveForm.Left(spos + 1));
 					}
-
-					waveForms.push_back(waveForm);
 				}
+
+				waveForms.push_back(waveForm);
 			}
-		} while (_findnext(dirHandle, &dirInfo) == 0);
-		_findclose(dirHandle);
+		}
 	}
 	catch (...)
 	{
@@ -440,70 +534,251 @@ bool WaveformTone::LoadWaveform(int bank, int instrumentID)
 
 void WaveformTone::FreeWaveforms()
 {
+	//The I/O thread reads the mapped files.
+	streamer.Stop();
 	for (auto& item : waveForms)
 	{
-		delete[] item.leftChannel;
-		delete[] item.rightChannel;
-
-		item.leftChannel = item.rightChannel = nullptr;
+		if (item.mapping == nullptr)
+			delete[] item.data;
+		item.data = nullptr;
+		item.mapping.reset();
 	}
 	waveForms.clear();
+	//waveformPath may be set to another bank before loading again.
+	packedBank.Close();
+}
+
+size_t WaveformTone::GetWaveformBytes()
+{
+	size_t bytes = 0;
+	for (auto& item : waveForms)
+		bytes += item.size * item.channels * sizeof(int16_t);
+	return bytes;
+}
+
+bool WaveformTone::PackWaveforms(const std::string& bankFileName)
+{
+	//Every instrument folder of every bank folder is loaded. They are read, so that the stereo waveforms with identical
+	//channels are packed as mono.
+	FreeWaveforms();
+	WaveformLoading loadingSave = loading;
+	loading = WaveformLoading::Read;
+	bool loaded = true;
+	std::error_code error;
+	for (std::filesystem::directory_iterator bankIt(waveformPath, error), end; !error && bankIt != end; bankIt.increment(error))
+	{
+		std::string bankName = bankIt->path().filename().string();
+		if (!bankIt->is_directory(error) || bankName.compare(0, 4, "Bank") != 0)
+			continue;
+		int bank = atoi(bankName.c_str() + 4);
+		for (std::filesystem::directory_iterator it(bankIt->path(), error); !error && it != end; it.increment(error))
+		{
+			if (it->is_directory(error))
+				loaded = LoadWaveform(bank, atoi(it->path().filename().string().c_str())) && loaded;
+		}
+	}
+	loading = loadingSave;
+	if (error || !loaded)
+		return false;
+
+	//The index is sorted by bank and instrument. The waveforms of an instrument keep their order, in which SetPitch searches them.
+	std::vector<WaveformType> sorted(waveForms);
+	std::stable_sort(sorted.begin(), sorted.end(), [](const WaveformType& a, const WaveformType& b) {
+		return a.bank < b.bank || (a.bank == b.bank && a.instrumentID < b.instrumentID);
+	});
+	std::vector<PackedWaveform> entries;
+	std::vector<const int16_t*> data;
+	for (auto& item : sorted)
+	{
+		if (item.size < 2)	//Too short to be played.
+			continue;
+		entries.push_back({ item.bank, item.instrumentID, item.pitch, item.pitchFrom, item.pitchTo, item.frequencyBase, item.loopStartAt, item.loopEndAt,
+			item.size, 0, static_cast<uint8_t>(item.loop), static_cast<uint8_t>(item.alwaysSustain), static_cast<uint16_t>(item.channels), 0 });
+		data.push_back(item.data);
+	}
+	return PackedBank::Write(bankFileName, entries, data);
+}
+
+const SampleStreamer& WaveformTone::GetStreamer()
+{
+	return streamer;
+}
+
+size_t WaveformTone::GetMappedBytes()
+{
+	size_t bytes = 0;
+	for (auto& item : waveForms)
+	{
+		if (item.mapping != nullptr)
+			bytes += item.size * item.channels * sizeof(int16_t);
+	}
+	return bytes;
 }
 
 bool WaveformTone::TriggerPulse(double& gl, double& gr)
 {
-	if (portamentoEnable)
+	return RenderPulse(gl, gr);
+}
+
+WaveformTone::~WaveformTone()
+{
+	if (stream != -1)
+		streamer.Close(stream, streamGeneration);
+}
+
+bool WaveformTone::AdvanceStream(size_t frames)
+{
+	const WaveformType& wave = waveForms[selectedWaveform];
+	if (!streamOpened)
 	{
-		PortamentoAdjust();	//portamentoEnable will be set to false when done.
+		//The head was read when the waveform was loaded.
+		streamOpened = true;
+		if (wave.mapping != nullptr && streamer.IsRunning())
+		{
+			size_t frameBytes = wave.channels * sizeof(int16_t);
+			size_t head = (std::min)(static_cast<size_t>(streamHeadMilliseconds * SAMPLE_RATE / 1000), wave.size);
+			size_t offset = reinterpret_cast<const uint8_t*>(wave.data) - wave.mapping->GetData();
+			//The loop, and the frames the interpolation reads before it, are kept.
+			size_t keep = wave.size;
+			if (wave.loop)
+				keep = static_cast<size_t>((std::max)(wave.loopStartAt - INTERPOLATION_REACH, 0.0));
+			stream = streamer.Open(wave.mapping.get(), offset, wave.size * frameBytes, head * frameBytes, keep * frameBytes, streamGeneration);
+		}
 	}
+	if (stream == -1)
+		return true;
+
+	//A looped waveform is not read after its loop, where the phase wraps.
+	size_t end = wave.size;
+	if (wave.loop)
+		end = (std::min)(end, static_cast<size_t>(wave.loopEndAt) + 1 + INTERPOLATION_REACH);
+	size_t current = static_cast<size_t>(phase >> PHASE_FRACTION_BITS);
+	size_t consumed = current > INTERPOLATION_REACH ? current - INTERPOLATION_REACH : 0;
+	size_t position = current + static_cast<size_t>(frequencyRatio * frames) + 1 + INTERPOLATION_REACH;
+	size_t wanted = position + static_cast<size_t>(streamLookaheadMilliseconds * SAMPLE_RATE / 1000 * frequencyRatio);
+	size_t frameBytes = wave.channels * sizeof(int16_t);
+	return streamer.Advance(stream, streamGeneration, (std::min)(consumed, end) * frameBytes, (std::min)(position, end) * frameBytes, (std::min)(wanted, end) * frameBytes)
+		|| !streamHold;
+}
 
-	if (selectedWaveform == -1)
+int WaveformTone::NextPhases(uint64_t* phases, int count, int& valid)
+{
+	//The waveform is looked up once per chunk. Its fields are copied to locals, which the writes to the phases cannot alias.
+	const WaveformType& wave = waveForms[selectedWaveform];
+	const uint64_t loopStart = Interpolation::ToPhase(wave.loopStartAt);
+	const uint64_t loopEnd = Interpolation::ToPhase(wave.loopEndAt);
+	const bool loop = wave.loop && loopEnd > loopStart;
+	const size_t lastPos = wave.size - 1;
+
+	//Vibrato, portamento and pitch bend ramp the frequency at control rate.
+	if (controlCountdown == 0 && ControlPeriod())
 	{
-		gl = gr = 0;
-		return false;
+		frequencyStep = (PitchFrequency() - frequency) / CONTROL_RATE;
+		controlCountdown = CONTROL_RATE;
 	}
-	else
+	int64_t stepDelta = 0;
+	double startFrequency = frequency;
+	if (controlCountdown > 0)
 	{
-		double pos = frequencyRatio * toneSampleCount;
+		count = (std::min)(count, controlCountdown);
+		controlCountdown -= count;
+		//The first sample is already one step on.
+		ChangeFrequency(frequency + frequencyStep);
+		stepDelta = static_cast<int64_t>(std::llround(frequencyStep / wave.frequencyBase * PHASE_ONE));
+	}
 
-		//If I should loop
-		if (waveForms[selectedWaveform].loop && pos >= waveForms[selectedWaveform].loopEndAt)
+	//The phases of the chunk. The ramp adds stepDelta to the step every sample, in two's complement.
+	//A looped tone keeps its phase in the loop: the chunk is split where the phase passes loopEnd, and the phase
+	//is wrapped there once, so the loop filling the phases has no branch.
+	uint64_t step = phaseStep;
+	for (int n = 0; n < count; )
+	{
+		int segment = count - n;
+		if (loop)
 		{
-			double span = pos - waveForms[selectedWaveform].loopEndAt;
-			double timesOf = span / (waveForms[selectedWaveform].loopEndAt - waveForms[selectedWaveform].loopStartAt);
-			double fractionPart = timesOf - static_cast<size_t>(timesOf);
-			pos = waveForms[selectedWaveform].loopStartAt + (waveForms[selectedWaveform].loopEndAt - waveForms[selectedWaveform].loopStartAt) * fractionPart;
+			if (phase >= loopEnd)
+			{
+				phase -= loopEnd - loopStart;
+				if (phase >= loopEnd)	//A step longer than the loop.
+					phase = loopStart + (phase - loopEnd) % (loopEnd - loopStart);
+			}
+			//The samples surely before loopEnd, at the largest step of the segment.
+			//A step of 0, at a frequency too low for the phase to resolve, never gets there.
+			uint64_t maxStep = stepDelta > 0 ? step + static_cast<uint64_t>(stepDelta) * (segment - 1) : step;
+			uint64_t before = maxStep == 0 ? segment : (loopEnd - phase - 1) / maxStep + 1;
+			if (before < static_cast<uint64_t>(segment))
+				segment = static_cast<int>(before);
 		}
+		for (int end = n + segment; n < end; n++)
+		{
+			phases[n] = phase;
+			phase += step;
+			step += static_cast<uint64_t>(stepDelta);
+		}
+	}
+	if (stepDelta != 0)
+	{
+		//The step is set from the frequency at the end of the ramp, so that the rounding of stepDelta does not add up.
+		frequency = startFrequency + frequencyStep * count;
+		frequencyRatio = frequency / wave.frequencyBase;
+		phaseStep = Interpolation::ToPhase(frequencyRatio);
+	}
+
+	//The tone ends at the first position that can not be interpolated.
+	valid = 0;
+	while (valid < count && (phases[valid] >> PHASE_FRACTION_BITS) < lastPos)
+		valid++;
+	return count;
+}
 
-		size_t linearPos = static_cast<size_t>(pos);
-		if (linearPos >= waveForms[selectedWaveform].size - 1)
+bool WaveformTone::RenderBlock(SampleType* left, SampleType* right, size_t frames)
+{
+	//A voice whose frames are not read yet is held, silent, until they are.
+	if (loading == WaveformLoading::Stream && selectedWaveform != -1 && !AdvanceStream(frames))
+	{
+		for (size_t i = 0; i < frames; i++)
+			left[i] = right[i] = 0;
+		return true;
+	}
+	uint64_t phases[TONE_CHUNK_SIZE];
+	double samplesLeft[TONE_CHUNK_SIZE];
+	double samplesRight[TONE_CHUNK_SIZE];
+	double volume = 0.6 * GetVelocity() / 127.0;	//Normalize to 60%
+	bool release = releaseVelocity >= 0 && !GetSustain();
+	for (size_t start = 0; start < frames; )
+	{
+		if (selectedWaveform == -1)
 		{
+			for (size_t i = start; i < frames; i++)
+				left[i] = right[i] = 0;
 			return false;
 		}
-		else
+		const WaveformType& wave = waveForms[selectedWaveform];
+		int valid = 0;
+		int chunk = NextPhases(phases, static_cast<int>((std::min)(frames - start, TONE_CHUNK_SIZE)), valid);
+		Interpolation::Render(interpolation, wave.data, wave.size, wave.channels, phases, samplesLeft, samplesRight, valid, frequencyRatio);
+		//A mono waveform plays the same samples on both sides.
+		const double* sourceRight = wave.channels == 2 ? samplesRight : samplesLeft;
+
+		for (int n = 0; n < chunk; n++, start++)
 		{
-			//With linear interpolation between two sample values.
-			double linear = pos - linearPos;	//This should be in 0 - 1
-			gl = waveForms[selectedWaveform].leftChannel[linearPos] * (1 - linear) + waveForms[selectedWaveform].leftChannel[linearPos + 1] * linear;
-			gr = waveForms[selectedWaveform].rightChannel[linearPos] * (1 - linear) + waveForms[selectedWaveform].rightChannel[linearPos + 1] * linear;
-			toneSampleCount++;
-
+			if (n == valid || selectedWaveform == -1)
+			{
+				for (size_t i = start; i < frames; i++)
+					left[i] = right[i] = 0;
+				return false;
+			}
+			double gl = samplesLeft[n];
+			double gr = sourceRight[n];
 			if (soft)
 			{
 				gl *= 0.5;
 				gr *= 0.5;
 			}
-			if (!autoStereo)
-			{
-//				gl = (1 - (pitch / 127 * 0.6 + 0.2)) * gl;
-//				gr = (pitch / 127 * 0.6 + 0.2) * gr;
-//				gl = gr = (gl + gr) / 2;
-			}
-			//Normalize to 60%
-			gl *= 0.6 * GetVelocity() / 127.0;
-			gr *= 0.6 * GetVelocity() / 127.0;
+			gl *= volume;
+			gr *= volume;
 
-			if (releaseVelocity >= 0 && !GetSustain())
+			if (release)
 			{
 				gl *= static_cast<double>(evlpSampleCount) / releaseVelocity;
 				gr *= static_cast<double>(evlpSampleCount) / releaseVelocity;
@@ -511,10 +786,59 @@ bool WaveformTone::TriggerPulse(double& gl, double& gr)
 				if (evlpSampleCount == 0)
 					selectedWaveform = -1;
 			}
+			left[start] = static_cast<SampleType>(gl);
+			right[start] = static_cast<SampleType>(gr);
+		}
+	}
+	return true;
+}
 
-			return true;
+bool WaveformTone::PrepareVoice(VoiceBatch& batch, int lane, size_t frames, bool& playing)
+{
+	//The batch interpolates linearly.
+	if (interpolation != InterpolationQuality::Linear)
+		return false;
+	batch.count[lane] = 0;
+	playing = selectedWaveform != -1;
+	if (!playing || (loading == WaveformLoading::Stream && !AdvanceStream(frames)))
+		return true;
+
+	const WaveformType& wave = waveForms[selectedWaveform];
+	bool release = releaseVelocity >= 0 && !GetSustain();
+	batch.data[lane] = wave.data;
+	batch.channels[lane] = wave.channels;
+	batch.soft[lane] = soft ? 0.5 : 1;
+	batch.volume[lane] = 0.6 * GetVelocity() / 127.0;	//Normalize to 60%
+	batch.envelope[lane] = release ? static_cast<double>(evlpSampleCount) : 1;
+	batch.envelopeStep[lane] = release ? 1 : 0;
+	batch.envelopeScale[lane] = release ? releaseVelocity : 1;
+
+	//As RenderBlock does: the tone ends where its phase can not be interpolated, or at the end of its release.
+	size_t end = release ? (std::min)(frames, evlpSampleCount) : frames;
+	size_t filled = 0;
+	while (filled < end)
+	{
+		int valid = 0;
+		int chunk = NextPhases(batch.phases[lane] + filled, static_cast<int>((std::min)(end - filled, TONE_CHUNK_SIZE)), valid);
+		filled += valid;
+		if (valid < chunk)
+		{
+			playing = false;
+			break;
+		}
+	}
+	if (release)
+	{
+		evlpSampleCount -= filled;
+		if (evlpSampleCount == 0)
+		{
+			selectedWaveform = -1;
+			if (filled < frames)
+				playing = false;
 		}
 	}
+	batch.count[lane] = static_cast<int>(filled);
+	return true;
 }
 
 void WaveformTone::ReleaseKey(int velocity)
@@ -523,16 +847,14 @@ void WaveformTone::ReleaseKey(int velocity)
 		Tone::ReleaseKey(velocity);
 }
 
-void WaveformTone::ReCalibrateFrequency()
+void WaveformTone::ChangeFrequency(double newFrequency)
 {
 	if (selectedWaveform != -1)
 	{
-		double frequencyRatioSave = frequencyRatio;	//Old ratio
-		SetFrequency();
-		frequencyRatio = frequency / waveForms[selectedWaveform].frequencyBase;	//New ratio
-
-		//Adjust toneSampleCount so that the change in frequency does not affect the wave alignments.
-		toneSampleCount = frequencyRatioSave * toneSampleCount / frequencyRatio;
+		frequency = newFrequency;
+		frequencyRatio = frequency / waveForms[selectedWaveform].frequencyBase;
+		//The phase is kept, only its step changes.
+		phaseStep = Interpolation::ToPhase(frequencyRatio);
 	}
 }
 
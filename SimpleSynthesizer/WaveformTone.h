@@ -20,6 +20,21 @@
 
 #pragma once
 
+#include <memory>
+#include "Interpolation.h"
+class MappedFile;
+class SampleStreamer;
+
+//How the sample data of the waveform files is loaded.
+enum class WaveformLoading
+{
+    Read,       //Read into memory allocated for each waveform.
+    Map,        //Mapped from the files, read by the system when it is played first. Falls back to Read for a file that can not be mapped.
+                //A packed bank is always mapped.
+    Prefetch,   //Mapped, and all of the files are read ahead.
+    Stream      //Mapped. The head of each waveform is read when it is loaded, the rest is read by an I/O thread ahead of the voices.
+};
+
 //Structures for reading .wav file
 //Not using structures from Windows for compatibility with, maybe later, other systems
 #pragma pack(push)
@@ -76,17 +91,37 @@ public:
         bool alwaysSustain;     //Some instruments should play all the samples without responding to NoteOff
         double loopStartAt;
         double loopEndAt;
-        size_t size;            //Size of sample data.
-        int16_t* leftChannel;   //16bit sample data of left channel
-        int16_t* rightChannel;  //16bit sample data of right channel
+        size_t size;            //Size of sample data, in frames.
+        int channels;           //1 or 2. A stereo file with identical channels is stored as mono, unless it is mapped.
+        const int16_t* data;    //16bit sample data. The left and right samples of a stereo frame are interleaved.
+        std::shared_ptr<MappedFile> mapping;    //The mapped file or packed bank data points into. nullptr if data is allocated.
+
+        //The left sample of frame pos, which the loop points are found on.
+        int16_t Left(size_t pos) const { return data[pos * channels]; }
     };
     
     //waveForms is static, the waveforms are loaded only once.
     //That is, waveForms is public to every note of the instrument.
     static std::vector<WaveformType> waveForms;
     
+    //Root folder of the waveform banks, or a packed bank file. Relative to the working directory by default.
+    static std::string waveformPath;
+    //Interpolation of the samples of all waveform tones. Linear by default.
+    static InterpolationQuality interpolation;
+    //Map by default.
+    static WaveformLoading loading;
+    //When streaming: the milliseconds of each waveform read when it is loaded, and read ahead of a voice.
+    static double streamHeadMilliseconds;
+    static double streamLookaheadMilliseconds;
+    //When streaming, hold a voice silent for a block it would play before its frames are read, instead of waiting for the
+    //disk on the render thread. For realtime playback. An offline render waits, so that it does not depend on the disk.
+    static bool streamHold;
+
     //Load wave forms. All waveforms of one instrument are loaded into the memory only when it is needed.
     static bool LoadWaveform(int bank, int instrumentID);
+    //Load all the waveforms of the folder at waveformPath and write them to a packed bank file, which can be set as
+    //waveformPath then. The waveforms stay loaded. Returns false if the folder can not be read or the file written.
+    static bool PackWaveforms(const std::string& bankFileName);
 
     //Map those not sampled general midi instruments to a sampled one.
     static void MapGMInstrument(int& instrumentID);
@@ -96,14 +131,47 @@ public:
     int selectedWaveform{ -1 };
     //Used to resample the wave for a different pitch
     double frequencyRatio{ 1 };
+    //Position in the waveform and its step per sample (frequencyRatio), fixed point with PHASE_FRACTION_BITS fraction bits.
+    //A pitch change only changes the step, toneSampleCount is not used.
+    uint64_t phase{ 0 };
+    uint64_t phaseStep{ 0 };
     //Waveform instrument is organized in banks and should have an instrument id.
     int bank{ 0 };
     int instrumentID{ 0 };
-
-    virtual void ReCalibrateFrequency();
+    //The stream of the SampleStreamer reading ahead of this tone. -1 if none.
+    int stream{ -1 };
+    unsigned streamGeneration{ 0 };
+    bool streamOpened{ false };
+
+    //Tell the stream how far the next frames will read, opening it first. Returns false if the voice is to be held.
+    bool AdvanceStream(size_t frames);
+    //Fill the phases of the next count frames at most, ramping the frequency at control rate. Returns the frames filled,
+    //fewer where a ramp ends. valid is set to those that can be interpolated, the tone ends at the first one that can not.
+    int NextPhases(uint64_t* phases, int count, int& valid);
+
+    virtual void ChangeFrequency(double newFrequency);
 public:
     //Free wave forms' memory. Call only once when system shuts down.
     static void FreeWaveforms();
+    //Bytes of sample data of the loaded waveforms, and how many of them are mapped from the files.
+    static size_t GetWaveformBytes();
+    static size_t GetMappedBytes();
+    //Set the root folder of the waveform banks, or a packed bank file. Call before loading a midi file.
+    static void SetWaveformPath(const std::string& path) { waveformPath = path; }
+    //Set the interpolation quality of the samples. Call before loading a midi file.
+    static void SetInterpolation(InterpolationQuality quality) { interpolation = quality; }
+    //Set how the waveforms are loaded. Call before loading a midi file.
+    static void SetWaveformLoading(WaveformLoading _loading) { loading = _loading; }
+    //Set the head and the lookahead of streaming, 200ms and 500ms by default, and whether the voices the I/O thread is behind
+    //are held. Call before loading a midi file.
+    static void SetStreaming(double headMilliseconds, double lookaheadMilliseconds, bool hold = true)
+    {
+        streamHeadMilliseconds = headMilliseconds;
+        streamLookaheadMilliseconds = lookaheadMilliseconds;
+        streamHold = hold;
+    }
+    //The statistics of streaming.
+    static const SampleStreamer& GetStreamer();
 
     virtual void SetPitch(const double _pitch)
     {
@@ -115,12 +183,16 @@ public:
             {
                 selectedWaveform = i;
                 frequencyRatio = frequency / waveForms[i].frequencyBase;
+                phaseStep = Interpolation::ToPhase(frequencyRatio);
                 return;
             }
         }
     }
 
     virtual bool TriggerPulse(double& gl, double& gr);
+    virtual bool RenderBlock(SampleType* left, SampleType* right, size_t frames);
+    //With linear interpolation, the tones are rendered in batches.
+    virtual bool PrepareVoice(VoiceBatch& batch, int lane, size_t frames, bool& playing);
     virtual void ReleaseKey(int velocity);
 
     WaveformTone() : Tone()
@@ -138,6 +210,8 @@ public:
     WaveformTone(const WaveformTone& copy) : Tone(copy)
     {
         selectedWaveform = copy.selectedWaveform;
+        phase = copy.phase;
+        phaseStep = copy.phaseStep;
     }
 
     WaveformTone& operator = (const WaveformTone& copy)
@@ -145,4 +219,6 @@ public:
         Tone::operator = (copy);
         return *this;
     }
+
+    virtual ~WaveformTone();
 };
\ No newline at end of file
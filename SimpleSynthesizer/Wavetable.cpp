@@ -0,0 +1,164 @@
+/*
+	SimpleSynthesizer V0.2
+	Band limited wavetables for the synthetic tones.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <memory>
+#include "Tone.h"
+#include "Wavetable.h"
+
+constexpr int ANALYZE_SIZE = WAVETABLE_SIZE * 16;	//Samples of a shape to be analyzed. The partials above WAVETABLE_SIZE / 2 are dropped anyway.
+
+//In place radix 2 FFT. data.size() must be a power of 2. sign = -1 for forward, 1 for inverse (not scaled).
+static void FFT(std::vector<std::complex<double>>& data, int sign)
+{
+	size_t n = data.size();
+	for (size_t i = 1, j = 0; i < n; i++)
+	{
+		size_t bit = n >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j)
+			std::swap(data[i], data[j]);
+	}
+	for (size_t len = 2; len <= n; len <<= 1)
+	{
+		double angle = sign * pi2 / len;
+		std::complex<double> step(std::cos(angle), std::sin(angle));
+		for (size_t i = 0; i < n; i += len)
+		{
+			std::complex<double> w(1);
+			for (size_t k = 0; k < len / 2; k++)
+			{
+				std::complex<double> even = data[i + k];
+				std::complex<double> odd = data[i + k + len / 2] * w;
+				data[i + k] = even + odd;
+				data[i + k + len / 2] = even - odd;
+				w *= step;
+			}
+		}
+	}
+}
+
+Wavetable::Wavetable(const std::vector<Partial>& partials, int _cycles) : cycles(_cycles)
+{
+	tables.resize(static_cast<size_t>(WAVETABLE_LEVELS) * (WAVETABLE_SIZE + 1));
+	std::vector<std::complex<double>> spectrum(WAVETABLE_SIZE);
+	for (int level = 0; level < WAVETABLE_LEVELS; level++)
+	{
+		int maxHarmonic = (WAVETABLE_SIZE / 2) >> level;
+		maxFrequencies[level] = SAMPLE_RATE / 2 * cycles / maxHarmonic;
+
+		//a * sin + b * cos = Re((b - ia) * e^(i * angle))
+		std::fill(spectrum.begin(), spectrum.end(), std::complex<double>(0));
+		for (auto& item : partials)
+		{
+			if (item.harmonic > 0 && item.harmonic <= maxHarmonic && item.harmonic < WAVETABLE_SIZE / 2)
+				spectrum[item.harmonic] += std::complex<double>(item.cosAmplitude, -item.sinAmplitude);
+		}
+		FFT(spectrum, 1);
+
+		float* table = tables.data() + static_cast<size_t>(level) * (WAVETABLE_SIZE + 1);
+		for (int n = 0; n < WAVETABLE_SIZE; n++)
+			table[n] = static_cast<float>(spectrum[n].real());
+		table[WAVETABLE_SIZE] = table[0];
+	}
+}
+
+std::vector<Wavetable::Partial> Wavetable::Analyze(double (*shape)(double x))
+{
+	std::vector<std::complex<double>> data(ANALYZE_SIZE);
+	for (int n = 0; n < ANALYZE_SIZE; n++)
+		data[n] = shape(static_cast<double>(n) / ANALYZE_SIZE);
+	FFT(data, -1);
+
+	std::vector<Partial> partials;
+	for (int k = 1; k < WAVETABLE_SIZE / 2; k++)
+	{
+		double sinAmplitude = -2 * data[k].imag() / ANALYZE_SIZE;
+		double cosAmplitude = 2 * data[k].real() / ANALYZE_SIZE;
+		if (std::fabs(sinAmplitude) > 1e-7 || std::fabs(cosAmplitude) > 1e-7)
+			partials.push_back({ k, sinAmplitude, cosAmplitude });
+	}
+	return partials;
+}
+
+void WavetableOscillator::SetFrequency(double frequency)
+{
+	increment = frequency / wavetable->GetCycles() / SAMPLE_RATE;
+	table = wavetable->GetTable(frequency);
+}
+
+void WavetableOscillator::Render(double* out, size_t frames, double frequencyStep)
+{
+	double incrementStep = frequencyStep / wavetable->GetCycles() / SAMPLE_RATE;
+	//The phase of every sample is calculated from the start of the block, so the samples do not depend on each other
+	//and the loop can be vectorized. The phase is never negative, so the wrap is a truncation instead of a branch.
+	int size = static_cast<int>(frames);	//An int converts to double in SIMD, a size_t does not.
+	double start = phase, step = increment;	//Locals, which out cannot alias.
+	for (int n = 0; n < size; n++)
+	{
+		double count = static_cast<double>(n);
+		double position = start + count * step + count * (count - 1) / 2 * incrementStep;
+		out[n] = position - static_cast<int>(position);
+	}
+	double count = static_cast<double>(frames);
+	phase += count * increment + count * (count - 1) / 2 * incrementStep;
+	phase -= static_cast<int>(phase);
+
+	for (size_t n = 0; n < frames; n++)
+	{
+		double pos = out[n] * WAVETABLE_SIZE;
+		int i = static_cast<int>(pos);
+		out[n] = table[i] + (table[i + 1] - table[i]) * (pos - i);
+	}
+}
+
+//The shapes the synthetic tones used to calculate every sample.
+static double SquareShape(double x)
+{
+	double g = (x > 0.5 ? 1 - x : x) * 64 - 16;
+	return g > 1 ? 1 : (g < -1 ? -1 : g);
+}
+
+static double TriangleShape(double x)
+{
+	return (x > 0.2 ? (1 - x) * 5 / 8 : x * 2.5) * 4 - 1;
+}
+
+static std::unique_ptr<const Wavetable> squareWavetable;
+static std::unique_ptr<const Wavetable> triangleWavetable;
+
+void Wavetable::Initialize()
+{
+	squareWavetable.reset(new Wavetable(Analyze(SquareShape)));
+	triangleWavetable.reset(new Wavetable(Analyze(TriangleShape)));
+}
+
+const Wavetable& Wavetable::Square()
+{
+	return *squareWavetable;
+}
+
+const Wavetable& Wavetable::Triangle()
+{
+	return *triangleWavetable;
+}
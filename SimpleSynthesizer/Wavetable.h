@@ -0,0 +1,93 @@
+/*
+	SimpleSynthesizer V0.2
+	Band limited wavetables for the synthetic tones.
+	A wavetable is a sum of harmonic partials, stored as one table per octave of fundamental frequency (mipmaps).
+	Each level only has the partials that stay below the Nyquist frequency at the highest fundamental of its octave,
+	so a tone read from the level of its frequency never aliases.
+	The tables are built once at startup. Reading is a phase accumulator and a linear interpolation between two samples.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <vector>
+
+constexpr int WAVETABLE_SIZE = 2048;	//Samples of a level. Holds up to 1023 partials.
+constexpr int WAVETABLE_LEVELS = 11;	//Level n has up to 1024 >> n partials.
+
+class Wavetable
+{
+public:
+	//amplitude of sin(2 * pi * harmonic * x) + amplitude of cos(2 * pi * harmonic * x), x is the phase of the table from 0 to 1.
+	struct Partial
+	{
+		int harmonic;
+		double sinAmplitude;
+		double cosAmplitude;
+	};
+
+protected:
+	//WAVETABLE_LEVELS tables of WAVETABLE_SIZE + 1 samples. The last sample repeats the first one for the interpolation.
+	std::vector<float> tables;
+	//The highest fundamental frequency each level can play without aliasing.
+	double maxFrequencies[WAVETABLE_LEVELS];
+	//Cycles of the fundamental in the table. A tone with a partial below its fundamental needs more than one.
+	int cycles;
+
+public:
+	Wavetable(const std::vector<Partial>& partials, int _cycles = 1);
+
+	//The partials of a periodic shape. shape is called with x from 0 to 1 and returns one cycle.
+	static std::vector<Partial> Analyze(double (*shape)(double x));
+
+	int GetCycles() const { return cycles; }
+
+	//The table to play a fundamental frequency.
+	const float* GetTable(double frequency) const
+	{
+		int level = 0;
+		while (level < WAVETABLE_LEVELS - 1 && frequency > maxFrequencies[level])
+			level++;
+		return tables.data() + static_cast<size_t>(level) * (WAVETABLE_SIZE + 1);
+	}
+
+	//Build the wavetables of the synthetic tones. Called by Tone::InitializeTables.
+	static void Initialize();
+	//Wavetables of the synthetic tones.
+	static const Wavetable& Square();
+	static const Wavetable& Triangle();
+};
+
+class WavetableOscillator
+{
+protected:
+	const Wavetable* wavetable;
+	const float* table{ nullptr };
+	double phase{ 0 };		//0 - 1
+	double increment{ 0 };	//Phase per sample
+
+public:
+	WavetableOscillator(const Wavetable& _wavetable) : wavetable(&_wavetable)
+	{
+	}
+
+	//Keeps the phase, so that the frequency can be changed while playing.
+	void SetFrequency(double frequency);
+
+	//Read a block of frames samples. The frequency ramps by frequencyStep every sample, the table stays the same.
+	//Call SetFrequency after a ramp to set the frequency it ends at.
+	void Render(double* out, size_t frames, double frequencyStep);
+};
@@ -56,8 +56,8 @@ void FxChorus::Start(int depth)
 		delete[] bufferLeft;
 		delete[] bufferRight;
 	}
-	bufferLeft = new double[bufferSize];
-	bufferRight = new double[bufferSize];
+	bufferLeft = new SampleType[bufferSize];
+	bufferRight = new SampleType[bufferSize];
 
 	for (int i = 0; i < bufferSize; i++)
 		bufferLeft[i] = bufferRight[i] = 0;
@@ -65,7 +65,7 @@ void FxChorus::Start(int depth)
 	isEnabled = (depth > 0);
 }
 
-void FxChorus::TriggerPulse(const double inLeft, const double inRight, double& outLeft, double& outRight)
+void FxChorus::TriggerPulse(const SampleType inLeft, const SampleType inRight, SampleType& outLeft, SampleType& outRight)
 {
 	if (!isEnabled)
 	{
@@ -82,8 +82,8 @@ void FxChorus::TriggerPulse(const double inLeft, const double inRight, double& o
 	bufferLeft[pos] = inLeft;
 	bufferRight[pos] = inRight;
 
-	double oL = 0;
-	double oR = 0;
+	SampleType oL = 0;
+	SampleType oR = 0;
 
 	for (int i = 0; i < numChorus; i++)
 	{
@@ -92,8 +92,8 @@ void FxChorus::TriggerPulse(const double inLeft, const double inRight, double& o
 		double modulationGain = (modulationValue > 0.5 ? 1 - modulationValue : modulationValue) * chorus[i].modulationDepth + 1 - chorus[i].modulationDepth;
 
 		int chorusStartFrom = (bufferSize + pos - chorus[i].delayPulse) % bufferSize;
-		oL += bufferLeft[chorusStartFrom] * chorus[i].decay * (127 - static_cast<double>(chorus[i].pan)) / 127 * modulationGain;
-		oR += bufferRight[chorusStartFrom] * chorus[i].decay * static_cast<double>(chorus[i].pan) / 127 * modulationGain;
+		oL += bufferLeft[chorusStartFrom] * static_cast<SampleType>(chorus[i].decay * (127 - static_cast<double>(chorus[i].pan)) / 127 * modulationGain);
+		oR += bufferRight[chorusStartFrom] * static_cast<SampleType>(chorus[i].decay * static_cast<double>(chorus[i].pan) / 127 * modulationGain);
 
 		chorus[i].phase = (chorus[i].phase + 1) % modulationCycle;
 	}
@@ -41,8 +41,8 @@ class FxChorus
 	ChorusParam chorus[MAX_CHORUS]{};
 	int numChorus{ 5 };
 
-	double* bufferLeft{ nullptr };
-	double* bufferRight{ nullptr };
+	SampleType* bufferLeft{ nullptr };
+	SampleType* bufferRight{ nullptr };
 
 	int bufferSize{ 0 };
 	int pos{ 0 };
@@ -55,5 +55,5 @@ public:
 
 	void Start(int depth);
 
-	void TriggerPulse(const double inLeft, const double inRight, double& outLeft, double& outRight);
+	void TriggerPulse(const SampleType inLeft, const SampleType inRight, SampleType& outLeft, SampleType& outRight);
 };
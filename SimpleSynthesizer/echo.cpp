@@ -54,8 +54,8 @@ void FxEcho::Start(int depth)
 
 	if (bufferLeft == nullptr)
 	{
-		bufferLeft = new double[EchoBufferSize];
-		bufferRight = new double[EchoBufferSize];
+		bufferLeft = new SampleType[EchoBufferSize];
+		bufferRight = new SampleType[EchoBufferSize];
 		pos = 0;
 		for (int i = 0; i < EchoBufferSize; i++)
 		{
@@ -77,7 +77,7 @@ void FxEcho::Start(int depth)
 */
 }
 
-void FxEcho::TriggerPulse(const double inLeft, const double inRight, double& outLeft, double& outRight)
+void FxEcho::TriggerPulse(const SampleType inLeft, const SampleType inRight, SampleType& outLeft, SampleType& outRight)
 {
 	if (!isEnabled)
 	{
@@ -94,14 +94,14 @@ void FxEcho::TriggerPulse(const double inLeft, const double inRight, double& out
 	bufferLeft[pos] = inLeft;
 	bufferRight[pos] = inRight;
 
-	double l = 0;
-	double r = 0;
+	SampleType l = 0;
+	SampleType r = 0;
 
 	for (auto& item : echoes)
 	{
 		size_t echoPos = ((int)EchoBufferSize + (int)pos - item.delayPulse) % EchoBufferSize;
-		l += bufferLeft[echoPos] * item.decay;
-		r += bufferRight[echoPos] * item.decay;
+		l += bufferLeft[echoPos] * static_cast<SampleType>(item.decay);
+		r += bufferRight[echoPos] * static_cast<SampleType>(item.decay);
 	}
 
 	outLeft = l + (wetOnly ? 0 : inLeft);
@@ -40,8 +40,8 @@ class FxEcho
 
 	EchoParam echoes[ECHO_TIMES]{};
 
-	double* bufferLeft{ nullptr };
-	double* bufferRight{ nullptr };
+	SampleType* bufferLeft{ nullptr };
+	SampleType* bufferRight{ nullptr };
 
 	size_t pos;
 
@@ -53,5 +53,5 @@ public:
 
 	void Start(int depth);
 
-	void TriggerPulse(const double inLeft, const double inRight, double& outLeft, double& outRight);
+	void TriggerPulse(const SampleType inLeft, const SampleType inRight, SampleType& outLeft, SampleType& outRight);
 };
@@ -34,7 +34,7 @@
 void Filter::CreateBuffer(int bufferSize)
 {
     size = bufferSize;
-    buffer = new double[size];
+    buffer = new SampleType[size];
     ptr = buffer;
     for (int i = 0; i < bufferSize; i++)
         buffer[i] = 0;
@@ -77,9 +77,9 @@ void Reverb::Create(double sample_rate_Hz,
     double a = -1 / log(1 - 0.3);           //Set minimum feedback
     double b = 100 / (log(1 - 0.98) * a + 1);  // Set maximum feedback
 
-    feedback = 1 - exp((reverberance - b) / (a * b));
+    feedback = static_cast<SampleType>(1 - exp((reverberance - b) / (a * b)));
     hf_damping = hf_damping / 100 * 0.3 + 0.2;
-    gain = dB_to_linear(wet_gain_dB) * 0.015;
+    gain = static_cast<SampleType>(dB_to_linear(wet_gain_dB) * 0.015);
 
 //    for (i = 0; i <= ceil(depth); ++i)
     for (i = 0; i < 2; ++i)
@@ -28,6 +28,7 @@
 
 #include <vector>
 #include <iostream>
+#include "Tone.h"
 
 #define M_LN10 2.30258509299404568402
 #define dB_to_linear(x) exp((x) * M_LN10 * 0.05)
@@ -36,8 +37,8 @@ class Filter
 {
 protected:
     size_t size{ 0 };
-    double* buffer{ nullptr };
-    double* ptr{ nullptr };
+    SampleType* buffer{ nullptr };
+    SampleType* ptr{ nullptr };
     void Advance()
     {
         if (--ptr < buffer)
@@ -51,13 +52,13 @@ public:
 class CombFilter : public Filter
 {
 protected:
-    double  store{};
+    SampleType store{};
 public:
     CombFilter() : Filter() {}
 
-    inline double Process(const double& input, const double& feedback, const double& hf_damping)
+    inline SampleType Process(const SampleType& input, const SampleType& feedback, const SampleType& hf_damping)
     {
-        double output = *ptr;
+        SampleType output = *ptr;
         store = output + (store - output) * hf_damping;
         *ptr = input + store * feedback;
         Advance();
@@ -70,10 +71,10 @@ class AllpassFilter : public Filter
 public:
     AllpassFilter() : Filter() {}
 
-    inline double Process(const double& input)
+    inline SampleType Process(const SampleType& input)
     {
-        double output = *ptr;
-        *ptr = input + output * 0.5;
+        SampleType output = *ptr;
+        *ptr = input + output * static_cast<SampleType>(0.5);
         Advance();
         return output - input;
     }
@@ -97,8 +98,8 @@ public:
 
     void CreateFilters(double rate, double scale, double offset);
 
-    inline void Process(const double& input, double& output,
-        const double& feedback, const double& hf_damping, const double& gain)
+    inline void Process(const SampleType& input, SampleType& output,
+        const SampleType& feedback, const SampleType& hf_damping, const SampleType& gain)
     {
         output = 0;
 
@@ -121,9 +122,9 @@ public:
 class Reverb
 {
 protected:
-    double feedback{};
-    double hf_damping{};
-    double gain{};
+    SampleType feedback{};
+    SampleType hf_damping{};
+    SampleType gain{};
     FilterArray filters[2]{};
 
 public:
@@ -136,7 +137,7 @@ public:
         double stereo_depth,
         size_t buffer_size);
 
-    inline void Process(const double& inLeft, const double& inRight, double& outLeft, double& outRight)
+    inline void Process(const SampleType& inLeft, const SampleType& inRight, SampleType& outLeft, SampleType& outRight)
     {
         filters[0].Process(inLeft, outLeft, feedback, hf_damping, gain);
         filters[1].Process(inRight, outRight, feedback, hf_damping, gain);
@@ -172,8 +173,8 @@ public:
 
     void Start(int depth);
 
-    inline void TriggerPulse(const double& inLeft, const double& inRight,
-        double& outLeft, double& outRight)
+    inline void TriggerPulse(const SampleType& inLeft, const SampleType& inRight,
+        SampleType& outLeft, SampleType& outRight)
     {
         if (!isEnabled)
         {
@@ -182,16 +183,16 @@ public:
             return;
         }
 
-        double oL0 = 0;
-        double oR0 = 0;
-        double oL1 = 0;
-        double oR1 = 0;
+        SampleType oL0 = 0;
+        SampleType oR0 = 0;
+        SampleType oL1 = 0;
+        SampleType oR1 = 0;
 
         reverbs[0].Process(inLeft, inRight, oL0, oR0);
         reverbs[1].Process(inLeft, inRight, oL1, oR1);
 
-        double oL = (1 - wet_only) * inLeft + 0.5 * (oL0 + oL1);
-        double oR = (1 - wet_only) * inRight + 0.5 * (oR0 + oR1);
+        SampleType oL = (1 - wet_only) * inLeft + static_cast<SampleType>(0.5) * (oL0 + oL1);
+        SampleType oR = (1 - wet_only) * inRight + static_cast<SampleType>(0.5) * (oR0 + oR1);
 
         outLeft = oL;
         outRight = oR;
@@ -0,0 +1,432 @@
+/*
+	SimpleSynthesizer V0.2
+	Benchmark of the synthesizer core.
+	Measures the effect processors and the whole MIDI playback in the engine mode it is built with.
+	Also compares pitch to frequency conversion by pow() and by PitchTable.
+	The synthetic tones are measured at the channel defaults, with their filters bypassed, and with the filters running.
+	Build it once with USE_FLOAT_ENGINE true and once with false to compare the float and double engines.
+	Playback is measured single-threaded and, on multi-core machines, once more with one render thread per core.
+
+	Usage: SimpleSynthesizerBench [file.mid]
+	Without a MIDI file, a song of synthetic tones (GM80/GM81) is generated so that no waveform bank is needed.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include "../SimpleSynthesizer/MidiFile.h"
+#include "../SimpleSynthesizer/Tone.h"
+#include "../SimpleSynthesizer/PitchTable.h"
+#include "../SimpleSynthesizer/OscillatorBank.h"
+#include "../SimpleSynthesizer/Interpolation.h"
+#include "../SimpleSynthesizer/MidiPlayback.h"
+#include "../SimpleSynthesizer/VoicePool.h"
+#include "../SimpleSynthesizer/VoiceBatch.h"
+
+constexpr double EFFECTS_SECONDS = 20;
+constexpr double MAX_PLAYBACK_SECONDS = 600;
+constexpr size_t PITCH_CONVERSIONS = 10000000;
+constexpr double ADDITIVE_SECONDS = 20;
+constexpr double INTERPOLATION_SECONDS = 20;
+constexpr double SYNTHETIC_SECONDS = 5;
+constexpr int SYNTHETIC_VOICES = 64;
+
+//A song of chords played by synthetic tones, with all effects on.
+static std::vector<std::vector<MidiWriteEvent>> GenerateSong(int tracks, int seconds, uint16_t timeBase)
+{
+	constexpr uint32_t tempo = 500000;	//120 BPM
+	std::vector<std::vector<MidiWriteEvent>> song(tracks);
+	uint32_t seed = 1;
+	for (int t = 0; t < tracks; t++)
+	{
+		auto& events = song[t];
+		uint8_t channel = static_cast<uint8_t>(t % 16 == 9 ? 10 : t % 16);
+		if (t == 0)
+			events.push_back({ 0, { E_NonMidi, M_PlaybackSpeed, 3, (tempo >> 16) & 0xff, (tempo >> 8) & 0xff, tempo & 0xff } });
+		events.push_back({ 0, { static_cast<uint8_t>(E_Program | channel), static_cast<uint8_t>(80 + t % 2) } });
+		events.push_back({ 0, { static_cast<uint8_t>(E_Controller | channel), C_VolumeCoarse, 90 } });
+		events.push_back({ 0, { static_cast<uint8_t>(E_Controller | channel), C_PanCoarse, static_cast<uint8_t>(t * 37 % 128) } });
+		events.push_back({ 0, { static_cast<uint8_t>(E_Controller | channel), C_EffectsLevel, 80 } });
+		events.push_back({ 0, { static_cast<uint8_t>(E_Controller | channel), C_ChorusDepth, 60 } });
+		events.push_back({ 0, { static_cast<uint8_t>(E_Controller | channel), C_CelesteLevel, 30 } });
+		events.push_back({ 0, { static_cast<uint8_t>(E_Controller | channel), C_ModulationWheelCoarse, static_cast<uint8_t>(t % 2 * 40) } });
+
+		//Chords of 4 notes every eighth note.
+		for (int n = 0; n < seconds * 4; n++)
+		{
+			seed = seed * 1103515245 + 12345;
+			uint8_t root = static_cast<uint8_t>(36 + (seed >> 16) % 48);
+			uint32_t tick = n * timeBase / 2;
+			for (int k = 0; k < 4; k++)
+				events.push_back({ tick, { static_cast<uint8_t>(E_NoteOn | channel), static_cast<uint8_t>(root + k * 4), 100 } });
+			for (int k = 0; k < 4; k++)
+				events.push_back({ tick + timeBase / 2, { static_cast<uint8_t>(E_NoteOff | channel), static_cast<uint8_t>(root + k * 4), 64 } });
+		}
+	}
+	return song;
+}
+
+static void Report(const std::string& name, double audioSeconds, double wallSeconds)
+{
+	std::cout << std::left << std::setw(10) << name << std::right << std::fixed << std::setprecision(3)
+		<< std::setw(9) << audioSeconds << " s of audio in " << std::setw(7) << wallSeconds << " s, "
+		<< std::setprecision(1) << std::setw(7) << audioSeconds / wallSeconds << "x realtime, "
+		<< std::setprecision(1) << std::setw(7) << wallSeconds * 1e9 / (audioSeconds * SAMPLE_RATE) << " ns/frame" << std::endl;
+}
+
+//Feed noise through the global effect processors, the way MidiPlayback uses them.
+static void BenchmarkEffects()
+{
+	FxChorus chorus{ true };
+	FxEcho echo{ true };
+	FxReverb reverb{ true };
+	chorus.Start(127);
+	echo.Start(127);
+	reverb.Start(127);
+
+	size_t frames = static_cast<size_t>(EFFECTS_SECONDS * SAMPLE_RATE);
+	uint32_t seed = 1;
+	SampleType sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < frames; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		SampleType in = static_cast<SampleType>(static_cast<int>(seed >> 16) % 20000 - 10000);
+		SampleType chorusL, chorusR, echoL, echoR, reverbL, reverbR;
+		chorus.TriggerPulse(in, in, chorusL, chorusR);
+		echo.TriggerPulse(in, in, echoL, echoR);
+		reverb.TriggerPulse(in + echoL, in + echoR, reverbL, reverbR);
+		sum += chorusL + chorusR + reverbL + reverbR;
+	}
+	std::chrono::duration<double> span = std::chrono::steady_clock::now() - start;
+	Report("Effects", EFFECTS_SECONDS, span.count());
+	if (sum == 0)	//Keep the results alive.
+		std::cout << "Effects are silent." << std::endl;
+}
+
+//Convert pitches with bends and vibrato, the way Tone::PitchFrequency is called, by pow() and by the table.
+static void BenchmarkPitch()
+{
+	std::vector<double> pitches(4096);
+	uint32_t seed = 1;
+	for (auto& item : pitches)
+	{
+		seed = seed * 1103515245 + 12345;
+		item = (seed >> 8) % 1280000 / 10000.0 - 2;	//-2 to 126, cents and finer.
+	}
+
+	double sumPow = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < PITCH_CONVERSIONS; i++)
+		sumPow += 440 * pow(2, (pitches[i % pitches.size()] - 69) / 12);
+	std::chrono::duration<double> spanPow = std::chrono::steady_clock::now() - start;
+
+	double sumTable = 0;
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < PITCH_CONVERSIONS; i++)
+		sumTable += PitchTable::PitchToFrequency(pitches[i % pitches.size()]);
+	std::chrono::duration<double> spanTable = std::chrono::steady_clock::now() - start;
+
+	double maxError = 0;	//In cents.
+	for (double pitch : pitches)
+	{
+		double error = std::fabs(1200 * std::log2(PitchTable::PitchToFrequency(pitch) / (440 * pow(2, (pitch - 69) / 12))));
+		maxError = std::max(maxError, error);
+	}
+
+	std::cout << std::left << std::setw(10) << "Pitch" << std::right << std::fixed << std::setprecision(2)
+		<< "pow " << spanPow.count() * 1e9 / PITCH_CONVERSIONS << " ns, table " << spanTable.count() * 1e9 / PITCH_CONVERSIONS << " ns, "
+		<< std::setprecision(1) << spanPow.count() / spanTable.count() << "x, max error "
+		<< std::scientific << std::setprecision(1) << maxError << " cent" << std::defaultfloat << std::endl;
+	if (sumPow == 0 || sumTable == 0)	//Keep the results alive.
+		std::cout << "Pitches are silent." << std::endl;
+}
+
+//Play OSCILLATOR_BANK_SIZE partials of an additive tone by sin() and by an OscillatorBank, with the same envelopes.
+static void BenchmarkAdditive()
+{
+	std::vector<OscillatorBank::Partial> partials;
+	for (int k = 1; k <= OSCILLATOR_BANK_SIZE; k++)
+		partials.push_back({ static_cast<double>(k), 1.0 / k, 0, 3.0 / k });
+	OscillatorBank::Spectrum spectrum(partials);
+	constexpr double frequency = 110;
+	size_t frames = static_cast<size_t>(ADDITIVE_SECONDS * SAMPLE_RATE);
+
+	double sumSin = 0;
+	std::vector<double> levels(partials.size()), decays(partials.size());
+	for (size_t k = 0; k < partials.size(); k++)
+	{
+		levels[k] = partials[k].sinAmplitude;
+		decays[k] = std::exp(-1 / (SAMPLE_RATE * partials[k].decayTime));
+	}
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < frames; i++)
+	{
+		double g = 0;
+		for (size_t k = 0; k < partials.size(); k++)
+		{
+			g += levels[k] * std::sin(pi2 * partials[k].ratio * frequency * i / SAMPLE_RATE);
+			levels[k] *= decays[k];
+		}
+		sumSin += g;
+	}
+	std::chrono::duration<double> spanSin = std::chrono::steady_clock::now() - start;
+
+	double sumBank = 0;
+	OscillatorBank bank(spectrum);
+	bank.SetFrequency(frequency);
+	float out[CONTROL_RATE];
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < frames; i += CONTROL_RATE)
+	{
+		bank.ControlPoint();
+		bank.Render(out, CONTROL_RATE);
+		for (float item : out)
+			sumBank += item;
+	}
+	std::chrono::duration<double> spanBank = std::chrono::steady_clock::now() - start;
+
+	std::cout << std::left << std::setw(10) << "Additive" << std::right << std::fixed << std::setprecision(2)
+		<< OSCILLATOR_BANK_SIZE << " partials, sin " << spanSin.count() * 1e9 / frames << " ns/frame, bank "
+		<< spanBank.count() * 1e9 / frames << " ns/frame, " << std::setprecision(1) << spanSin.count() / spanBank.count() << "x" << std::endl;
+	if (sumSin == 0 || sumBank == 0)	//Keep the results alive.
+		std::cout << "Partials are silent." << std::endl;
+}
+
+//Read a stereo waveform transposed up by each interpolation, the way a WaveformTone reads it: one block of positions at a time.
+static void BenchmarkInterpolation()
+{
+	constexpr size_t size = 1 << 16;
+	constexpr double ratio = 1.3;
+	std::vector<int16_t> data(size * 2);
+	for (size_t i = 0; i < size * 2; i++)
+		data[i] = static_cast<int16_t>(16000 * std::sin(pi2 * 440 * (i / 2) / SAMPLE_RATE) + (i * 7919 % 2001) - 1000);
+	size_t frames = static_cast<size_t>(INTERPOLATION_SECONDS * SAMPLE_RATE);
+
+	std::cout << std::left << std::setw(10) << "Interp" << std::right << std::fixed << std::setprecision(2);
+	uint64_t phases[TONE_CHUNK_SIZE];
+	double left[TONE_CHUNK_SIZE], right[TONE_CHUNK_SIZE];
+	double sum = 0;
+	for (InterpolationQuality quality : { InterpolationQuality::Linear, InterpolationQuality::Cubic, InterpolationQuality::Sinc8, InterpolationQuality::Sinc16 })
+	{
+		uint64_t phase = 0;
+		const uint64_t step = Interpolation::ToPhase(ratio);
+		const uint64_t end = static_cast<uint64_t>(size - 1) << PHASE_FRACTION_BITS;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < frames; i += TONE_CHUNK_SIZE)
+		{
+			for (size_t n = 0; n < TONE_CHUNK_SIZE; n++)
+			{
+				phases[n] = phase;
+				phase += step;
+				if (phase >= end)
+					phase -= end / 2;
+			}
+			Interpolation::Render(quality, data.data(), size, 2, phases, left, right, static_cast<int>(TONE_CHUNK_SIZE), ratio);
+			sum += left[7] + right[7];
+		}
+		std::chrono::duration<double> span = std::chrono::steady_clock::now() - start;
+		std::cout << Interpolation::GetName(quality) << " " << span.count() * 1e9 / frames << " ns/frame" << (quality == InterpolationQuality::Sinc16 ? "" : ", ");
+	}
+	std::cout << std::endl;
+	if (sum == 0)	//Keep the results alive.
+		std::cout << "Samples are silent." << std::endl;
+}
+
+//Read VOICE_BATCH_LANES voices of a mono and of a stereo waveform, transposed up by different ratios. First one at a time,
+//the way a WaveformTone reads it alone, then all of them at once by a VoiceBatch.
+static void BenchmarkVoiceBatch()
+{
+	constexpr size_t size = 1 << 16;
+	constexpr double volume = 0.6;
+	std::vector<int16_t> data(size * 2);
+	for (size_t i = 0; i < size * 2; i++)
+		data[i] = static_cast<int16_t>(16000 * std::sin(pi2 * 440 * (i / 2) / SAMPLE_RATE) + (i * 7919 % 2001) - 1000);
+	size_t frames = static_cast<size_t>(INTERPOLATION_SECONDS * SAMPLE_RATE);
+	const uint64_t end = static_cast<uint64_t>(size - 1) << PHASE_FRACTION_BITS;
+	static VoiceBatch batch;
+	double left[TONE_CHUNK_SIZE], right[TONE_CHUNK_SIZE];
+	SampleType sum = 0;
+
+	std::cout << std::left << std::setw(10) << "Batch" << std::right << std::fixed << std::setprecision(2) << VOICE_BATCH_LANES << " voices, ";
+	for (int channels : { 1, 2 })
+	{
+		uint64_t phases[VOICE_BATCH_LANES]{};
+		uint64_t steps[VOICE_BATCH_LANES];
+		for (int lane = 0; lane < VOICE_BATCH_LANES; lane++)
+		{
+			steps[lane] = Interpolation::ToPhase(1.3 + 0.1 * lane);
+			batch.data[lane] = data.data();
+			batch.channels[lane] = channels;
+			batch.count[lane] = static_cast<int>(TONE_CHUNK_SIZE);
+			batch.soft[lane] = 1;
+			batch.volume[lane] = volume;
+			batch.envelope[lane] = 1;
+			batch.envelopeStep[lane] = 0;
+			batch.envelopeScale[lane] = 1;
+		}
+		auto fill = [&](int lane)
+		{
+			for (size_t n = 0; n < TONE_CHUNK_SIZE; n++)
+			{
+				batch.phases[lane][n] = phases[lane];
+				phases[lane] += steps[lane];
+				if (phases[lane] >= end)
+					phases[lane] -= end / 2;
+			}
+		};
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < frames; i += TONE_CHUNK_SIZE)
+		{
+			for (int lane = 0; lane < VOICE_BATCH_LANES; lane++)
+			{
+				fill(lane);
+				Interpolation::Render(InterpolationQuality::Linear, data.data(), size, channels, batch.phases[lane], left, right, static_cast<int>(TONE_CHUNK_SIZE), 1.3);
+				const double* sourceRight = channels == 2 ? right : left;
+				for (size_t n = 0; n < TONE_CHUNK_SIZE; n++)
+				{
+					batch.left[lane][n] = static_cast<SampleType>(left[n] * volume);
+					batch.right[lane][n] = static_cast<SampleType>(sourceRight[n] * volume);
+				}
+				sum += batch.left[lane][7] + batch.right[lane][7];
+			}
+		}
+		std::chrono::duration<double> spanSingle = std::chrono::steady_clock::now() - start;
+
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < frames; i += TONE_CHUNK_SIZE)
+		{
+			for (int lane = 0; lane < VOICE_BATCH_LANES; lane++)
+				fill(lane);
+			batch.Render(VOICE_BATCH_LANES, TONE_CHUNK_SIZE);
+			for (int lane = 0; lane < VOICE_BATCH_LANES; lane++)
+				sum += batch.left[lane][7] + batch.right[lane][7];
+		}
+		std::chrono::duration<double> spanBatch = std::chrono::steady_clock::now() - start;
+		std::cout << (channels == 2 ? "stereo " : "mono ") << spanSingle.count() * 1e9 / frames / VOICE_BATCH_LANES << " one at a time, "
+			<< spanBatch.count() * 1e9 / frames / VOICE_BATCH_LANES << " batched ns/voice-frame" << (channels == 2 ? "" : ", ");
+	}
+	std::cout << std::endl;
+	if (sum == 0)	//Keep the results alive.
+		std::cout << "Batched voices are silent." << std::endl;
+}
+
+//Render SYNTHETIC_VOICES square and triangle tones a block at a time, the way a channel does. First with the cut off and
+//the resonance of the channel defaults, 0: the low pass filter is bypassed and the resonator runs at 0Hz. Then with the
+//resonance of 0 skipped (Tone::SetZeroResonanceOff), then with both filters running.
+static void BenchmarkSynthetic()
+{
+	VoicePool pool;
+	pool.Reserve(SYNTHETIC_VOICES);
+	size_t frames = static_cast<size_t>(SYNTHETIC_SECONDS * SAMPLE_RATE);
+	SampleType left[RENDER_BLOCK_SIZE], right[RENDER_BLOCK_SIZE];
+	SampleType sum = 0;
+
+	std::cout << std::left << std::setw(10) << "Synthetic" << std::right << std::fixed << std::setprecision(2) << SYNTHETIC_VOICES << " voices, ";
+	const char* modes[] = { "defaults ", "bypassed ", "filters " };
+	for (int mode = 0; mode < 3; mode++)
+	{
+		Tone::SetZeroResonanceOff(mode == 1);
+		std::vector<Tone*> tones;
+		for (int n = 0; n < SYNTHETIC_VOICES; n++)
+		{
+			Tone* tone = Tone::CreateTone(pool, 0, 80 + n % 2, 36 + n % 48, 100);
+			tone->SetFilterCutoffFreq(mode == 2 ? 3000 : 0);
+			tone->SetResonanceFreq(mode == 2 ? 1000 : 0);
+			tones.push_back(tone);
+		}
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < frames; i += RENDER_BLOCK_SIZE)
+		{
+			for (Tone* tone : tones)
+			{
+				tone->RenderBlock(left, right, RENDER_BLOCK_SIZE);
+				sum += left[0] + right[RENDER_BLOCK_SIZE - 1];
+			}
+		}
+		std::chrono::duration<double> span = std::chrono::steady_clock::now() - start;
+		std::cout << modes[mode] << span.count() * 1e9 / frames / SYNTHETIC_VOICES << " ns/voice-frame" << (mode == 2 ? "" : ", ");
+		for (Tone* tone : tones)
+			pool.Destroy(tone);
+	}
+	Tone::SetZeroResonanceOff(false);
+	std::cout << std::endl;
+	if (sum == 0)	//Keep the results alive.
+		std::cout << "Synthetic tones are silent." << std::endl;
+}
+
+static void BenchmarkPlayback(const std::string& fileName, int threads)
+{
+	static MidiPlayback playback;
+	playback.SetRenderThreads(threads);
+	playback.LoadMidiFile(fileName);
+
+	constexpr size_t frames = 1024;
+	std::vector<float> left(frames), right(frames);
+	size_t total = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (playback.PrepareBuffer(left.data(), right.data(), frames) && total < MAX_PLAYBACK_SECONDS * SAMPLE_RATE)
+		total += frames;
+	total += frames;
+	std::chrono::duration<double> span = std::chrono::steady_clock::now() - start;
+	Report(threads > 1 ? "Playback x" + std::to_string(threads) : std::string("Playback"), total / SAMPLE_RATE, span.count());
+}
+
+int main(int argc, char* argv[])
+{
+	std::cout << "SimpleSynthesizer benchmark, " << (USE_FLOAT_ENGINE ? "float" : "double") << " engine" << std::endl;
+	//The pitch table and the sinc kernels are measured without a MidiPlayback, which would build them.
+	Tone::InitializeTables();
+
+	std::string fileName;
+	if (argc > 1)
+		fileName = argv[1];
+	else
+	{
+		fileName = "SimpleSynthesizerBench.mid";
+		WriteMidiFile(fileName, 480, GenerateSong(8, 30, 480));
+	}
+
+	try
+	{
+		BenchmarkEffects();
+		BenchmarkPitch();
+		BenchmarkAdditive();
+		BenchmarkInterpolation();
+		BenchmarkVoiceBatch();
+		BenchmarkSynthetic();
+		BenchmarkPlayback(fileName, 1);
+		int cores = static_cast<int>(std::thread::hardware_concurrency());
+		if (cores > 1)
+			BenchmarkPlayback(fileName, cores);
+	}
+	catch (...)
+	{
+		std::cout << "Unable to load " << fileName << std::endl;
+		return 1;
+	}
+
+	if (argc <= 1)
+		std::remove(fileName.c_str());
+	return 0;
+}
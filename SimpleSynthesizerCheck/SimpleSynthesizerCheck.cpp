@@ -0,0 +1,462 @@
+/*
+	SimpleSynthesizer V0.2
+	Behaviour checks of the synthesizer core.
+	Small MIDI files of synthetic tones (GM80/GM81) are generated, so that no waveform bank is needed, and played through
+	MidiPlayback. The output and the voices of the channels are compared with what they should be.
+	Prints each check and returns 1 if any has failed. Run by ctest.
+
+	Usage: SimpleSynthesizerCheck
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <filesystem>
+#include "../SimpleSynthesizer/MidiFile.h"
+#include "../SimpleSynthesizer/Tone.h"
+#include "../SimpleSynthesizer/MidiPlayback.h"
+#include "../SimpleSynthesizer/WaveformTone.h"
+#include "../SimpleSynthesizer/VoicePool.h"
+
+constexpr int TIME_BASE = 480;
+constexpr uint32_t TEMPO = 500000;				//120 BPM.
+constexpr double FRAMES_PER_TICK = 45.9375;		//At TEMPO, exact in binary.
+constexpr const char* CHECK_FILE = "SimpleSynthesizerCheck.mid";
+constexpr const char* CHECK_WAVEFORMS = "SimpleSynthesizerCheckWaveform";
+
+static int failures = 0;
+
+static void Check(bool passed, const std::string& name)
+{
+	std::cout << (passed ? "PASS " : "FAIL ") << name << std::endl;
+	if (!passed)
+		failures++;
+}
+
+using SongEvent = MidiWriteEvent;
+using SongTrack = std::vector<SongEvent>;
+
+//Write the tracks to CHECK_FILE, the first track starting with the tempo.
+static void WriteSong(std::vector<SongTrack> tracks)
+{
+	tracks[0].insert(tracks[0].begin(), { 0, { E_NonMidi, M_PlaybackSpeed, 3, (TEMPO >> 16) & 0xff, (TEMPO >> 8) & 0xff, TEMPO & 0xff } });
+	WriteMidiFile(CHECK_FILE, TIME_BASE, std::move(tracks));
+}
+
+static SongEvent Event(uint32_t tick, uint8_t event, int channel, uint8_t param0, uint8_t param1)
+{
+	return { tick, { static_cast<uint8_t>(event | channel), param0, param1 } };
+}
+
+static std::unique_ptr<MidiPlayback> Load(int threads = 1)
+{
+	std::unique_ptr<MidiPlayback> playback(new MidiPlayback());
+	playback->printMessages = false;
+	playback->SetRenderThreads(threads);
+	playback->LoadMidiFile(CHECK_FILE);
+	return playback;
+}
+
+//Render frames, appended to left and right.
+static void Render(MidiPlayback& playback, size_t frames, std::vector<float>& left, std::vector<float>& right)
+{
+	size_t start = left.size();
+	left.resize(start + frames);
+	right.resize(start + frames);
+	playback.PrepareBuffer(left.data() + start, right.data() + start, frames);
+}
+
+//Chords of both synthetic tones on several tracks, with pan, modulation, pitch bend, portamento and all effects.
+static std::vector<SongTrack> ChordSong(int tracks, int chords)
+{
+	std::vector<SongTrack> song(tracks);
+	uint32_t seed = 1;
+	for (int t = 0; t < tracks; t++)
+	{
+		int channel = t % 16 == 9 ? 10 : t % 16;
+		SongTrack& track = song[t];
+		track.push_back({ 0, { static_cast<uint8_t>(E_Program | channel), static_cast<uint8_t>(80 + t % 2) } });
+		track.push_back(Event(0, E_Controller, channel, C_PanCoarse, static_cast<uint8_t>(t * 37 % 128)));
+		track.push_back(Event(0, E_Controller, channel, C_EffectsLevel, 80));
+		track.push_back(Event(0, E_Controller, channel, C_ChorusDepth, 60));
+		track.push_back(Event(0, E_Controller, channel, C_CelesteLevel, 30));
+		track.push_back(Event(0, E_Controller, channel, C_ModulationWheelCoarse, static_cast<uint8_t>(t % 2 * 40)));
+		track.push_back(Event(0, E_Controller, channel, C_Portamento, static_cast<uint8_t>(t % 3 == 0 ? 127 : 0)));
+		track.push_back(Event(0, E_Controller, channel, C_PortamentoTimeCoarse, 20));
+		for (int n = 0; n < chords; n++)
+		{
+			uint32_t tick = n * TIME_BASE / 2 + t * 7;
+			seed = seed * 1103515245 + 12345;
+			uint8_t root = static_cast<uint8_t>(36 + (seed >> 16) % 48);
+			for (int k = 0; k < 4; k++)
+				track.push_back(Event(tick, E_NoteOn, channel, static_cast<uint8_t>(root + k * 4), static_cast<uint8_t>(60 + k * 20)));
+			track.push_back(Event(tick + TIME_BASE / 8, E_PitchBend, channel, 0, static_cast<uint8_t>((seed >> 8) % 128)));
+			for (int k = 0; k < 4; k++)
+				track.push_back(Event(tick + TIME_BASE / 2 - k * 13, E_NoteOff, channel, static_cast<uint8_t>(root + k * 4), 64));
+		}
+	}
+	return song;
+}
+
+//Channels are rendered by any thread and summed in a fixed order, so the output does not depend on the count of threads.
+static void CheckRenderThreads()
+{
+	WriteSong(ChordSong(8, 16));
+	std::vector<float> left[2], right[2];
+	const int threads[2] = { 1, 4 };
+	for (int n = 0; n < 2; n++)
+	{
+		auto playback = Load(threads[n]);
+		Render(*playback, 10 * static_cast<size_t>(SAMPLE_RATE), left[n], right[n]);
+	}
+	bool sounding = std::any_of(left[0].begin(), left[0].end(), [](float v) { return v != 0; });
+	Check(sounding, "render threads: the chords sound");
+	bool same = std::memcmp(left[0].data(), left[1].data(), left[0].size() * sizeof(float)) == 0
+		&& std::memcmp(right[0].data(), right[1].data(), right[0].size() * sizeof(float)) == 0;
+	Check(same, "render threads: 4 threads render the same samples as 1");
+}
+
+//The events of all tracks are merged to one timeline and stamped with the frame of their tick through the tempo map.
+//A block is never rendered across an event, so a note starts at its frame.
+static void CheckTimeline()
+{
+	constexpr uint32_t HALF_TEMPO = TEMPO / 2;
+	std::vector<SongTrack> song(2);
+	song[0].push_back({ 0, { E_Program, 80 } });
+	song[0].push_back(Event(1, E_NoteOn, 0, 60, 100));
+	song[0].push_back(Event(480, E_NoteOff, 0, 60, 64));
+	song[0].push_back({ 960, { E_NonMidi, M_PlaybackSpeed, 3, (HALF_TEMPO >> 16) & 0xff, (HALF_TEMPO >> 8) & 0xff, HALF_TEMPO & 0xff } });
+	song[0].push_back(Event(1441, E_NoteOn, 0, 64, 100));
+	song[0].push_back(Event(1920, E_NoteOff, 0, 64, 64));
+	song[1].push_back({ 0, { E_Program | 1, 81 } });
+	song[1].push_back(Event(480, E_Controller, 1, C_VolumeCoarse, 100));
+	song[1].push_back(Event(1441, E_NoteOn, 1, 67, 100));
+	song[1].push_back(Event(1920, E_NoteOff, 1, 67, 64));
+	WriteSong(song);
+	auto playback = Load();
+
+	//Tick, track and frame of the events after the start.
+	struct Stamp
+	{
+		uint32_t tick;
+		uint16_t track;
+		size_t frame;
+	};
+	const Stamp expected[] = {
+		{ 1, 0, 46 },			//45.9375 frames a tick, rounded up.
+		{ 480, 0, 22050 },
+		{ 480, 1, 22050 },		//The same tick, after the events of the tracks before.
+		{ 960, 0, 44100 },
+		{ 1441, 0, 55148 },		//22.96875 frames a tick from tick 960 on, rounded up.
+		{ 1441, 1, 55148 },
+		{ 1920, 0, 66150 },
+		{ 1920, 1, 66150 },
+	};
+	std::vector<Stamp> stamps;
+	for (auto& item : playback->timeline)
+	{
+		const MidiEvent& evt = *item.event;
+		if (evt.timeTicks > 0 && !(evt.event == E_NonMidi && evt.params[0] == M_EndOfTrack))
+			stamps.push_back({ static_cast<uint32_t>(evt.timeTicks), item.track, item.frame });
+	}
+	bool stamped = stamps.size() == std::size(expected);
+	for (size_t n = 0; stamped && n < stamps.size(); n++)
+		stamped = stamps[n].tick == expected[n].tick && stamps[n].track == expected[n].track && stamps[n].frame == expected[n].frame;
+	Check(stamped, "timeline: events are stamped with their frames through the tempo map, in the order of the tracks");
+
+	//The first note has faded out long before the second tick.
+	std::vector<float> left, right;
+	Render(*playback, 55148 + RENDER_BLOCK_SIZE, left, right);
+	auto sounding = [&left](size_t start) { return std::find_if(left.begin() + start, left.end(), [](float v) { return v != 0; }) - left.begin(); };
+	Check(sounding(0) == 46, "timeline: a note sounds from the frame of its tick");
+	Check(sounding(44100) == 55148, "timeline: a note after a tempo change sounds from the frame of its tick");
+}
+
+//Render up to the first frame after the events of tick, at TEMPO.
+static void RenderTo(MidiPlayback& playback, uint32_t tick)
+{
+	size_t frame = static_cast<size_t>(std::ceil(tick * FRAMES_PER_TICK)) + 1;
+	std::vector<float> left, right;
+	if (frame > playback.currentFrame)
+		Render(playback, frame - playback.currentFrame, left, right);
+}
+
+//Keys of the voices of a channel that are not stolen, from the oldest to the newest.
+static std::vector<int> LiveKeys(const MidiPlayback::ChannelStatus& channel)
+{
+	std::vector<int> keys;
+	for (int n = 0; n < channel.toneCount; n++)
+	{
+		if (!channel.voices[n].IsStolen())
+			keys.push_back(channel.voices[n].key);
+	}
+	return keys;
+}
+
+//When a note on makes the voices exceed maxVoices, the voice chosen by the steal policy is stolen.
+static void CheckVoiceStealing()
+{
+	{
+		//The released voice first, then the oldest.
+		std::vector<SongTrack> song(1);
+		song[0].push_back({ 0, { E_Program, 80 } });
+		for (int n = 0; n < 4; n++)
+			song[0].push_back(Event(n * 10, E_NoteOn, 0, static_cast<uint8_t>(60 + n), 100));
+		song[0].push_back(Event(40, E_NoteOff, 0, 61, 64));
+		song[0].push_back(Event(41, E_NoteOn, 0, 64, 100));
+		song[0].push_back(Event(60, E_NoteOn, 0, 65, 100));
+		song[0].push_back(Event(960, E_NoteOff, 0, 65, 64));
+		WriteSong(song);
+		auto playback = Load();
+		playback->maxVoices = 4;
+		playback->stealPolicy = VoiceStealPolicy::OldestReleased;
+		const MidiPlayback::ChannelStatus& channel = playback->tracksStatus[0].channels[0];
+		RenderTo(*playback, 41);
+		Check(LiveKeys(channel) == std::vector<int>{ 60, 62, 63, 64 }, "steal oldest released: the released voice is stolen");
+		RenderTo(*playback, 60);
+		Check(LiveKeys(channel) == std::vector<int>{ 62, 63, 64, 65 }, "steal oldest released: then the oldest voice");
+		Check(playback->stolenNotes == 2 && playback->droppedNotes == 0, "steal oldest released: 2 notes stolen, none dropped");
+		RenderTo(*playback, 70);	//Longer than STEAL_FADE_FRAMES.
+		Check(channel.toneCount == 4, "steal oldest released: the stolen voices are gone after their fade");
+	}
+	{
+		//The levels are known after the first blocks.
+		std::vector<SongTrack> song(1);
+		song[0].push_back({ 0, { E_Program, 80 } });
+		song[0].push_back(Event(0, E_NoteOn, 0, 60, 127));
+		song[0].push_back(Event(0, E_NoteOn, 0, 62, 20));
+		song[0].push_back(Event(0, E_NoteOn, 0, 64, 90));
+		song[0].push_back(Event(100, E_NoteOn, 0, 67, 127));
+		song[0].push_back(Event(960, E_NoteOff, 0, 67, 64));
+		WriteSong(song);
+		auto playback = Load();
+		playback->maxVoices = 3;
+		playback->stealPolicy = VoiceStealPolicy::Quietest;
+		RenderTo(*playback, 100);
+		Check(LiveKeys(playback->tracksStatus[0].channels[0]) == std::vector<int>{ 60, 64, 67 }, "steal quietest: the softest note is stolen");
+		Check(playback->stolenNotes == 1, "steal quietest: 1 note stolen");
+	}
+	{
+		//The newer voice of the channel of lower priority is stolen rather than an older one.
+		std::vector<SongTrack> song(1);
+		song[0].push_back({ 0, { E_Program, 80 } });
+		song[0].push_back({ 0, { E_Program | 1, 81 } });
+		song[0].push_back(Event(0, E_NoteOn, 0, 60, 100));
+		song[0].push_back(Event(10, E_NoteOn, 1, 72, 100));
+		song[0].push_back(Event(20, E_NoteOn, 0, 64, 100));
+		song[0].push_back(Event(960, E_NoteOff, 0, 64, 64));
+		WriteSong(song);
+		auto playback = Load();
+		playback->maxVoices = 2;
+		playback->stealPolicy = VoiceStealPolicy::LowestPriority;
+		playback->channelPriority[0] = 1;
+		RenderTo(*playback, 20);
+		bool stolen = LiveKeys(playback->tracksStatus[0].channels[0]) == std::vector<int>{ 60, 64 } && LiveKeys(playback->tracksStatus[0].channels[1]).empty();
+		Check(stolen, "steal lowest priority: the voice of the lower priority channel is stolen");
+	}
+	{
+		//Without a limit, only a full channel drops notes.
+		std::vector<SongTrack> song(1);
+		song[0].push_back({ 0, { E_Program, 80 } });
+		for (int n = 0; n <= MAX_POLYPHONICS; n++)
+			song[0].push_back(Event(0, E_NoteOn, 0, static_cast<uint8_t>(30 + n), 100));
+		song[0].push_back(Event(960, E_NoteOff, 0, 30, 64));
+		WriteSong(song);
+		auto playback = Load();
+		RenderTo(*playback, 0);
+		bool dropped = playback->tracksStatus[0].channels[0].toneCount == MAX_POLYPHONICS && playback->droppedNotes == 1 && playback->stolenNotes == 0;
+		Check(dropped, "full channel: the note on beyond MAX_POLYPHONICS is dropped and counted");
+	}
+}
+
+//Key and key down of the voices of a channel that are not stolen, from the oldest to the newest.
+static std::vector<std::pair<int, bool>> KeysDown(const MidiPlayback::ChannelStatus& channel)
+{
+	std::vector<std::pair<int, bool>> keys;
+	for (int n = 0; n < channel.toneCount; n++)
+	{
+		if (!channel.voices[n].IsStolen())
+			keys.push_back({ channel.voices[n].key, channel.voices[n].keyDown });
+	}
+	return keys;
+}
+
+//A note off releases the oldest voice of its key whose key is down, and no voice of another key.
+static void CheckNoteOff()
+{
+	std::vector<SongTrack> song(1);
+	song[0].push_back({ 0, { E_Program, 80 } });
+	song[0].push_back(Event(0, E_Controller, 0, C_HoldPedal, 127));
+	song[0].push_back(Event(10, E_NoteOn, 0, 60, 100));
+	song[0].push_back(Event(20, E_NoteOn, 0, 60, 100));
+	song[0].push_back(Event(25, E_NoteOn, 0, 62, 100));
+	song[0].push_back(Event(30, E_NoteOff, 0, 60, 64));
+	song[0].push_back(Event(35, E_NoteOff, 0, 61, 64));
+	song[0].push_back(Event(40, E_NoteOff, 0, 60, 64));
+	song[0].push_back(Event(50, E_Controller, 0, C_HoldPedal, 0));
+	song[0].push_back(Event(80, E_NoteOff, 0, 62, 64));
+	//The pitch of a voice gliding from the last note is not its key.
+	song[0].push_back({ 0, { E_Program | 1, 81 } });
+	song[0].push_back(Event(0, E_Controller, 1, C_Portamento, 127));
+	song[0].push_back(Event(0, E_Controller, 1, C_PortamentoTimeCoarse, 40));
+	song[0].push_back(Event(10, E_NoteOn, 1, 60, 100));
+	song[0].push_back(Event(20, E_NoteOn, 1, 64, 100));
+	song[0].push_back(Event(30, E_NoteOff, 1, 60, 64));
+	song[0].push_back(Event(40, E_NoteOff, 1, 64, 64));
+	WriteSong(song);
+	auto playback = Load();
+	const MidiPlayback::ChannelStatus& channel = playback->tracksStatus[0].channels[0];
+	const MidiPlayback::ChannelStatus& gliding = playback->tracksStatus[0].channels[1];
+	using Keys = std::vector<std::pair<int, bool>>;
+
+	RenderTo(*playback, 30);
+	bool oldest = KeysDown(channel) == Keys{ { 60, false }, { 60, true }, { 62, true } }
+		&& channel.voices[0].tone->IsReleasing() && !channel.voices[1].tone->IsReleasing();
+	Check(oldest, "note off: the oldest voice of a stacked key is released first");
+	Check(KeysDown(gliding) == Keys{ { 60, false }, { 64, true } }, "note off: a gliding voice is matched by its key, not its pitch");
+	RenderTo(*playback, 35);
+	Check(KeysDown(channel) == Keys{ { 60, false }, { 60, true }, { 62, true } }, "note off: a key without a voice releases none");
+	RenderTo(*playback, 40);
+	bool sustained = KeysDown(channel) == Keys{ { 60, false }, { 60, false }, { 62, true } } && channel.keyFirst[60] == -1;
+	Check(sustained, "note off: both voices of the key are released, and kept sounding by the sustain pedal");
+	Check(KeysDown(gliding) == Keys{ { 60, false }, { 64, false } }, "note off: the voice of the second key is released");
+	RenderTo(*playback, 70);
+	Check(KeysDown(channel) == Keys{ { 62, true } }, "note off: the released voices end after the sustain pedal is up");
+	RenderTo(*playback, 100);
+	Check(channel.toneCount == 0, "note off: the last voice ends after its note off");
+}
+
+//Pitch bend is a parameter of the channel: it bends all the voices of a chord, and the notes played after it.
+static void CheckPitchBend()
+{
+	//A chord bent down a whole tone before it is played, after it is played at the same tick, and not bent.
+	std::vector<float> chord[3], unused;
+	for (int n = 0; n < 3; n++)
+	{
+		std::vector<SongTrack> song(1);
+		song[0].push_back({ 0, { E_Program, 80 } });
+		if (n == 0)
+			song[0].push_back(Event(0, E_PitchBend, 0, 0, 0));
+		song[0].push_back(Event(10, E_NoteOn, 0, 62, 100));
+		song[0].push_back(Event(10, E_NoteOn, 0, 66, 100));
+		if (n == 1)
+			song[0].push_back(Event(10, E_PitchBend, 0, 0, 0));
+		song[0].push_back(Event(100, E_NoteOff, 0, 62, 64));
+		song[0].push_back(Event(100, E_NoteOff, 0, 66, 64));
+		WriteSong(song);
+		auto playback = Load();
+		Render(*playback, static_cast<size_t>(100 * FRAMES_PER_TICK), chord[n], unused);
+	}
+	Check(chord[0] != chord[2], "pitch bend: the chord is bent");
+	Check(chord[0] == chord[1], "pitch bend: all the voices of the chord are bent, and the notes after the bend");
+}
+
+//Write a looped mono .wav file of a sine at the frequency of pitch, to the waveform folder of bank and instrumentID.
+static void WriteLoopedWave(int bank, int instrumentID, int pitch, uint32_t frames)
+{
+	std::filesystem::path dir = std::filesystem::path(CHECK_WAVEFORMS) / ("Bank" + std::to_string(bank)) / std::to_string(instrumentID);
+	std::filesystem::create_directories(dir);
+	std::vector<int16_t> samples(frames);
+	double frequency = PitchTable::PitchToFrequency(pitch);
+	for (uint32_t i = 0; i < frames; i++)
+		samples[i] = static_cast<int16_t>(std::lround(16000 * std::sin(2 * pi * frequency * i / SAMPLE_RATE)));
+
+	uint32_t bytes = frames * sizeof(int16_t);
+	RIFFHeader riffHeader{ 0x46464952, static_cast<uint32_t>(sizeof(RIFFHeader) - 8 + sizeof(WaveFormat) + sizeof(WaveDataHeader) + bytes), 0x45564157 };
+	WaveFormat waveFormat{ 0x20746d66, sizeof(WaveFormat) - 8, 1, 1, 44100, 44100 * sizeof(int16_t), sizeof(int16_t), 16 };
+	WaveDataHeader waveDataHeader{ 0x61746164, bytes };
+	std::ofstream file(dir / (std::to_string(pitch) + "_0_127_1.wav"), std::ios::out | std::ios::binary);
+	file.write(reinterpret_cast<const char*>(&riffHeader), sizeof(RIFFHeader));
+	file.write(reinterpret_cast<const char*>(&waveFormat), sizeof(WaveFormat));
+	file.write(reinterpret_cast<const char*>(&waveDataHeader), sizeof(WaveDataHeader));
+	file.write(reinterpret_cast<const char*>(samples.data()), bytes);
+}
+
+//A looped waveform keeps its phase in the loop, also at a frequency too low for the phase to resolve, where the step is 0.
+static void CheckLoopZeroStep()
+{
+	constexpr int BANK = 1;		//Not mapped as bank 0 is.
+	constexpr int PITCH = 105;	//200 cycles of the loop search fit in the short file.
+	WriteLoopedWave(BANK, 0, PITCH, 4096);
+	WaveformTone::SetWaveformPath(CHECK_WAVEFORMS);
+	bool loaded = WaveformTone::LoadWaveform(BANK, 0) && !WaveformTone::waveForms.empty();
+	Check(loaded, "zero step: the looped waveform is loaded");
+	if (!loaded)
+		return;
+	const WaveformTone::WaveformType& wave = WaveformTone::waveForms.back();
+	Check(wave.loop && wave.loopStartAt >= 0 && wave.loopStartAt < wave.loopEndAt && wave.loopEndAt <= wave.size - 1, "zero step: the loop is found");
+
+	VoicePool pool;
+	pool.Reserve(1);
+	WaveformTone* tone = pool.Create<WaveformTone>(BANK, 0, static_cast<double>(PITCH), 127);
+	SampleType left[RENDER_BLOCK_SIZE], right[RENDER_BLOCK_SIZE];
+	//The phase of the next frame is in the loop, or one step after it, at a step of 1 sample at most.
+	auto inLoop = [&]() {
+		double position = static_cast<double>(tone->phase) / PHASE_ONE;
+		return position >= wave.loopStartAt && position < wave.loopEndAt + 1;
+	};
+	//Blocks of a second each: played into the loop, bent down 250 tones to a step of 0, and back.
+	bool playing = true, looping = true, zeroStep = false;
+	const int bends[3] = { 8192, 0, 8192 };
+	for (int i = 0; i < 3; i++)
+	{
+		tone->PitchBend(bends[i], 500);
+		for (int n = 0; n < SAMPLE_RATE / RENDER_BLOCK_SIZE; n++)
+		{
+			playing = tone->RenderBlock(left, right, RENDER_BLOCK_SIZE) && playing;
+			looping = (i == 0 || inLoop()) && looping;
+			zeroStep = zeroStep || tone->phaseStep == 0;
+		}
+		looping = inLoop() && looping;
+	}
+	pool.Destroy(tone);
+	WaveformTone::FreeWaveforms();
+	Check(zeroStep, "zero step: the bent tone has a step of 0");
+	Check(playing, "zero step: the looped tone plays on");
+	Check(looping, "zero step: the phase stays in the loop");
+}
+
+int main()
+{
+	std::cout << "SimpleSynthesizer checks, " << (USE_FLOAT_ENGINE ? "float" : "double") << " engine" << std::endl;
+	try
+	{
+		CheckRenderThreads();
+		CheckTimeline();
+		CheckVoiceStealing();
+		CheckNoteOff();
+		CheckPitchBend();
+		CheckLoopZeroStep();
+	}
+	catch (...)
+	{
+		std::cout << "Unable to load " << CHECK_FILE << std::endl;
+		failures++;
+	}
+	std::remove(CHECK_FILE);
+	std::error_code error;
+	std::filesystem::remove_all(CHECK_WAVEFORMS, error);
+	std::cout << (failures ? std::to_string(failures) + " checks failed" : std::string("All checks passed")) << std::endl;
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,299 @@
+/*
+	SimpleSynthesizer V0.2
+	Command line renderer of the synthesizer core.
+	Renders a MIDI file to a 44.1kHz 16bit stereo .wav file as fast as the machine allows, without any audio device.
+
+	Usage: SimpleSynthesizerCli file.mid waveformFolder output.wav [-threads n] [-voices n] [-steal oldest|quietest|priority] [-sink file|null] [-ring frames] [-period frames] [-interp linear|cubic|sinc8|sinc16] [-load read|map|prefetch|stream] [-head ms] [-lookahead ms]
+	       SimpleSynthesizerCli -pack waveformFolder bank.ssb
+	waveformFolder is the folder holding Bank0, Bank512 and so on, or a packed bank.
+	-pack: write all the waveforms of waveformFolder to a packed bank, a single file that loads without reading a folder.
+	-threads n: the count of threads rendering the channels, 1 by default.
+	-voices n: limit the voices of all channels to n, 0 (no limit) by default.
+	-steal: the voice to steal when the limit is reached. The oldest released voice by default, or the quietest voice,
+	or a voice of the lowest priority channel (channels with a higher number have a higher priority here).
+	-sink file: stream through the ring buffer of an AudioStream to a FileSink instead of rendering straight to the file.
+	-sink null: stream to a NullSink that consumes the frames at real time pace, and report the underruns. Nothing is written.
+	-ring frames: the depth of the ring buffer of -sink.
+	-period frames: with -sink null, render each period of the null sink in realtime mode (no ring, no render ahead),
+	and report the render time of the periods against their deadline and the count of xruns. 64 - 256 frames for low latency.
+	-interp: the interpolation of the waveform samples. linear by default, the cheapest. The sinc ones are slower but do not alias
+	when a sample is transposed up.
+	-load: how the waveform files are loaded. map (the default) maps them into memory, so that they are only read when they
+	are played and are shared with other processes playing them. prefetch maps them and reads them ahead. read reads them.
+	stream maps them, reads the head of each waveform when it is loaded and the rest on an I/O thread ahead of the voices,
+	for banks larger than the memory, and gives back the pages the voices have passed. With -sink null, a voice the I/O thread
+	is behind is held silent, with the others the render waits for the disk. These underruns are reported.
+	-head ms, -lookahead ms: with -load stream, the head of each waveform read when it is loaded, 200ms by default,
+	and read ahead of each voice, 500ms by default.
+
+	Copyright (C) 2021 Feng Dai
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <filesystem>
+#include <cstdlib>
+#include "../SimpleSynthesizer/MidiFile.h"
+#include "../SimpleSynthesizer/Tone.h"
+#include "../SimpleSynthesizer/WaveformTone.h"
+#include "../SimpleSynthesizer/SampleStreamer.h"
+#include "../SimpleSynthesizer/MidiPlayback.h"
+#include "../SimpleSynthesizer/AudioStream.h"
+#include "../SimpleSynthesizer/AudioSink.h"
+
+constexpr size_t BUFFER_FRAMES = 4096;
+
+static void Usage()
+{
+	std::cout << "Usage: SimpleSynthesizerCli file.mid waveformFolder output.wav [-threads n] [-voices n] [-steal oldest|quietest|priority] [-sink file|null] [-ring frames] [-period frames] [-interp linear|cubic|sinc8|sinc16] [-load read|map|prefetch|stream] [-head ms] [-lookahead ms]" << std::endl
+		<< "       SimpleSynthesizerCli -pack waveformFolder bank.ssb" << std::endl;
+}
+
+//Write the waveforms of a folder to a packed bank.
+static int Pack(const std::string& waveformPath, const std::string& bankFileName)
+{
+	auto start = std::chrono::steady_clock::now();
+	WaveformTone::SetWaveformPath(waveformPath);
+	if (!WaveformTone::PackWaveforms(bankFileName))
+	{
+		std::cout << "Unable to pack " << waveformPath << " to " << bankFileName << std::endl;
+		return 1;
+	}
+	std::chrono::duration<double> span = std::chrono::steady_clock::now() - start;
+	std::cout << std::fixed << std::setprecision(1) << "Packed " << WaveformTone::waveForms.size() << " waveforms, "
+		<< WaveformTone::GetWaveformBytes() / 1048576.0 << " MB, to " << bankFileName << " in " << std::setprecision(3) << span.count() << " s" << std::endl;
+	return 0;
+}
+
+//Render straight to the file, as fast as possible. Returns the count of frames rendered.
+static size_t RenderToFile(MidiPlayback& playback, const std::string& outputFileName)
+{
+	std::ofstream file(outputFileName, std::ios::out | std::ios::binary);
+	if (!file)
+		throw 0;
+	FileSink::WriteWaveHeader(file);
+
+	std::vector<char> buffer(BUFFER_FRAMES * 4);
+	size_t frames = 0;
+	bool playing = true;
+	while (playing)
+	{
+		playing = playback.PrepareBuffer(buffer.data(), buffer.size());
+		file.write(buffer.data(), buffer.size());
+		frames += BUFFER_FRAMES;
+	}
+
+	FileSink::FinishWaveHeader(file, frames);
+	return frames;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 4)
+	{
+		Usage();
+		return 1;
+	}
+	if (std::string(argv[1]) == "-pack")
+	{
+		if (argc != 4)
+		{
+			Usage();
+			return 1;
+		}
+		return Pack(argv[2], argv[3]);
+	}
+	std::string midiFileName = argv[1];
+	std::string waveformPath = argv[2];
+	std::string outputFileName = argv[3];
+	int threads = 1;
+	std::string sinkName;
+	size_t ringFrames = DEFAULT_RING_FRAMES;
+	size_t periodFrames = 0;
+	int maxVoices = 0;
+	std::string stealName = "oldest";
+	InterpolationQuality interpolation = InterpolationQuality::Linear;
+	bool interpolationValid = true;
+	std::string loadName = "map";
+	double headMilliseconds = 200;
+	double lookaheadMilliseconds = 500;
+	for (int i = 4; i < argc; i++)
+	{
+		std::string option = argv[i];
+		if (i + 1 >= argc)
+		{
+			Usage();
+			return 1;
+		}
+		if (option == "-threads")
+			threads = std::atoi(argv[++i]);
+		else if (option == "-voices")
+			maxVoices = std::atoi(argv[++i]);
+		else if (option == "-steal")
+			stealName = argv[++i];
+		else if (option == "-sink")
+			sinkName = argv[++i];
+		else if (option == "-ring")
+			ringFrames = static_cast<size_t>(std::atol(argv[++i]));
+		else if (option == "-period")
+			periodFrames = static_cast<size_t>(std::atol(argv[++i]));
+		else if (option == "-interp")
+			interpolationValid = Interpolation::FromName(argv[++i], interpolation);
+		else if (option == "-load")
+			loadName = argv[++i];
+		else if (option == "-head")
+			headMilliseconds = std::atof(argv[++i]);
+		else if (option == "-lookahead")
+			lookaheadMilliseconds = std::atof(argv[++i]);
+		else
+		{
+			Usage();
+			return 1;
+		}
+	}
+	if ((!sinkName.empty() && sinkName != "file" && sinkName != "null") || (periodFrames > 0 && sinkName != "null")
+		|| (stealName != "oldest" && stealName != "quietest" && stealName != "priority") || !interpolationValid
+		|| (loadName != "read" && loadName != "map" && loadName != "prefetch" && loadName != "stream")
+		|| headMilliseconds < 0 || lookaheadMilliseconds < 0)
+	{
+		Usage();
+		return 1;
+	}
+
+	if (!std::filesystem::exists(waveformPath))
+	{
+		std::cout << "Waveform folder " << waveformPath << " not found." << std::endl;
+		return 1;
+	}
+
+	static MidiPlayback playback;
+	WaveformTone::SetWaveformPath(waveformPath);
+	WaveformTone::SetInterpolation(interpolation);
+	if (loadName == "read")
+		WaveformTone::SetWaveformLoading(WaveformLoading::Read);
+	else if (loadName == "prefetch")
+		WaveformTone::SetWaveformLoading(WaveformLoading::Prefetch);
+	else if (loadName == "stream")
+		WaveformTone::SetWaveformLoading(WaveformLoading::Stream);
+	//Only the null sink plays at real time pace.
+	WaveformTone::SetStreaming(headMilliseconds, lookaheadMilliseconds, sinkName == "null");
+	playback.SetRenderThreads(threads);
+	playback.maxVoices = maxVoices;
+	if (stealName == "quietest")
+		playback.stealPolicy = VoiceStealPolicy::Quietest;
+	else if (stealName == "priority")
+	{
+		playback.stealPolicy = VoiceStealPolicy::LowestPriority;
+		for (int ch = 0; ch < MAX_MIDI_CHANNELS; ch++)
+			playback.channelPriority[ch] = ch;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	try
+	{
+		playback.LoadMidiFile(midiFileName);
+	}
+	catch (...)
+	{
+		std::cout << "Unable to load " << midiFileName << std::endl;
+		return 1;
+	}
+	std::chrono::duration<double> loadSpan = std::chrono::steady_clock::now() - start;
+
+	size_t frames = 0;
+	std::unique_ptr<AudioStream> stream;
+	start = std::chrono::steady_clock::now();
+	if (sinkName.empty())
+	{
+		try
+		{
+			frames = RenderToFile(playback, outputFileName);
+		}
+		catch (...)
+		{
+			std::cout << "Unable to create " << outputFileName << std::endl;
+			return 1;
+		}
+	}
+	else
+	{
+		std::unique_ptr<AudioSink> sink;
+		stream.reset(new AudioStream(ringFrames));
+		if (sinkName == "file")
+			sink.reset(new FileSink(outputFileName));
+		else if (periodFrames > 0)
+		{
+			sink.reset(new NullSink(periodFrames));
+			stream->SetRealtime(true);
+			playback.printMessages = false;
+		}
+		else
+			sink.reset(new NullSink());
+		if (!stream->Start(&playback, sink.get()))
+		{
+			std::cout << "Unable to open the " << sinkName << " sink" << std::endl;
+			return 1;
+		}
+		while (!stream->IsFinished())
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		stream->Stop();
+		frames = static_cast<size_t>(playback.currentFrame);
+	}
+	std::chrono::duration<double> renderSpan = std::chrono::steady_clock::now() - start;
+
+	double audioSeconds = frames / SAMPLE_RATE;
+	std::cout << std::fixed << std::setprecision(3)
+		<< "Rendered " << audioSeconds << " s of audio to " << (sinkName == "null" ? std::string("the null sink") : outputFileName)
+		<< " with " << playback.GetRenderThreads() << " thread(s)" << std::endl
+		<< "Load time:       " << loadSpan.count() << " s" << std::endl
+		<< "Render time:     " << renderSpan.count() << " s" << std::endl
+		<< "Realtime factor: " << std::setprecision(1) << audioSeconds / renderSpan.count() << "x" << std::endl
+		<< "Interpolation:   " << Interpolation::GetName(interpolation) << std::endl
+		<< "Waveforms:       " << WaveformTone::GetWaveformBytes() / 1048576.0 << " MB, " << WaveformTone::GetMappedBytes() / 1048576.0 << " MB mapped" << std::endl
+		<< "Peak voices:     " << playback.peakVoices << std::endl;
+	if (maxVoices > 0)
+	{
+		std::cout << "Voice limit:     " << maxVoices << ", " << stealName << " stolen first" << std::endl
+			<< "Stolen notes:    " << playback.stolenNotes << std::endl;
+	}
+	std::cout << "Dropped notes:   " << playback.droppedNotes << std::endl;
+	if (loadName == "stream")
+	{
+		const SampleStreamer& streamer = WaveformTone::GetStreamer();
+		std::cout << "Streaming:       head " << std::setprecision(0) << headMilliseconds << " ms, lookahead " << lookaheadMilliseconds << " ms" << std::endl
+			<< "Stream reads:    " << std::setprecision(1) << streamer.headBytes / 1048576.0 << " MB of heads (" << streamer.lockedBytes / 1048576.0
+			<< " MB locked), " << streamer.readBytes / 1048576.0 << " MB ahead, " << streamer.droppedBytes / 1048576.0 << " MB given back" << std::endl
+			<< "Underruns:       " << streamer.underruns << ", voices not streamed: " << streamer.unstreamedVoices << std::endl;
+	}
+	if (stream && stream->IsRealtime())
+	{
+		std::cout << "Period:          " << periodFrames << " frames, deadline " << std::setprecision(3) << stream->GetDeadline() * 1000 << " ms" << std::endl
+			<< "Period render:   mean " << stream->GetMeanRenderTime() * 1000 << " ms, max " << stream->GetMaxRenderTime() * 1000 << " ms" << std::endl
+			<< "Xruns:           " << stream->GetXruns() << " of " << stream->GetPeriods() << " periods" << std::endl;
+	}
+	else if (stream)
+	{
+		std::cout << "Ring buffer:     " << stream->GetRingFrames() << " frames" << std::endl
+			<< "Underruns:       " << stream->GetUnderruns() << " (" << stream->GetUnderrunFrames() << " frames)" << std::endl;
+	}
+	return 0;
+}
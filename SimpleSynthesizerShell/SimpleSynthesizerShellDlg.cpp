@@ -9,8 +9,12 @@
 #include "afxdialogex.h"
 #pragma comment(lib, "winmm.lib")
 #include <mmsystem.h>
+#include <thread>
+#include <atomic>
 #include "thread.h"
 #include "..\SimpleSynthesizer\WaveformTone.h"
+#include "..\SimpleSynthesizer\AudioStream.h"
+#include "..\SimpleSynthesizer\AudioSink.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -20,37 +24,114 @@
 //Codes for playing back a midi file
 //
 
-//Playback buffer
-constexpr int BUFFER_SIZE = (int)SAMPLE_RATE;
-constexpr int BUFFER_COUNT = 2;
-char buffers[BUFFER_COUNT][BUFFER_SIZE];
+//Playback through an AudioStream in realtime mode.
+//Each device buffer is rendered right when the device has played it, so the latency is about DEVICE_BUFFER_COUNT buffers.
+constexpr int DEVICE_BUFFER_COUNT = 4;
+constexpr int DEVICE_BUFFER_FRAMES = 256;	//About 5.8ms per buffer.
 
-bool bShouldPrepareData = false;
-LPWAVEHDR pWaveHeader;
+class WaveOutSink : public AudioSink
+{
+protected:
+	HWAVEOUT        hWaveOut{};
+	WAVEHDR         waveHeader[DEVICE_BUFFER_COUNT]{};	//For each buffer.
+	int16_t         buffers[DEVICE_BUFFER_COUNT][DEVICE_BUFFER_FRAMES * 2]{};
+	HANDLE          hBufferDone{};	//Set by the device each time it has played a buffer.
+
+	std::thread thread;
+	std::atomic<bool> quit{ false };
+
+	void Worker(AudioStream* stream);
+
+public:
+	~WaveOutSink()
+	{
+		Close();
+	}
+
+	virtual bool Open(AudioStream* stream);
+	virtual void Close();
+};
 
-void CALLBACK WaveOutProc(HWAVEOUT hwo,
-	UINT uMsg,
-	DWORD dwInstance,
-	DWORD dwParam1,
-	DWORD dwParam2)
+bool WaveOutSink::Open(AudioStream* stream)
 {
-	if (uMsg == WOM_DONE)
+	WAVEFORMATEX waveFormatEx{};
+	waveFormatEx.wFormatTag = WAVE_FORMAT_PCM;	//PCM 
+	waveFormatEx.nChannels = 2;
+	waveFormatEx.nSamplesPerSec = static_cast<DWORD>(SAMPLE_RATE);	//
+	waveFormatEx.nBlockAlign = waveFormatEx.nChannels * 2;	//in bytes
+	waveFormatEx.nAvgBytesPerSec = static_cast<DWORD>(SAMPLE_RATE) * waveFormatEx.nBlockAlign; //
+	waveFormatEx.wBitsPerSample = 16;
+	waveFormatEx.cbSize = 0;
+
+	hBufferDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+	//Get a handle for wave playback. The device signals hBufferDone instead of calling back,
+	//because a buffer can not be written to the device inside its callback.
+	if (waveOutOpen(&hWaveOut, WAVE_MAPPER, &waveFormatEx, (DWORD_PTR)hBufferDone, 0L, CALLBACK_EVENT) != MMSYSERR_NOERROR)
+	{
+		hWaveOut = NULL;
+		Close();
+		return false;
+	}
+
+	for (int i = 0; i < DEVICE_BUFFER_COUNT; i++)
 	{
-		pWaveHeader = (LPWAVEHDR)dwParam1;
-		bShouldPrepareData = true;
+		waveHeader[i].lpData = (LPSTR)buffers[i];
+		waveHeader[i].dwBufferLength = sizeof(buffers[i]);
+		waveHeader[i].dwFlags = 0L;
+		waveHeader[i].dwLoops = 0L;
+		waveOutPrepareHeader(hWaveOut, &waveHeader[i], sizeof(WAVEHDR));
+		stream->Pull(buffers[i], DEVICE_BUFFER_FRAMES);
+		waveOutWrite(hWaveOut, &waveHeader[i], sizeof(WAVEHDR));
 	}
-	return;
+
+	quit = false;
+	thread = std::thread(&WaveOutSink::Worker, this, stream);
+	return true;
 }
 
-class PlaybackThread : public CThread
+void WaveOutSink::Close()
 {
-protected:
+	quit = true;
+	if (thread.joinable())
+		thread.join();
 
-	HWAVEOUT        hWaveOut{};
-	WAVEHDR         waveHeader[BUFFER_COUNT]{};	//For each buffer.
-	WAVEFORMATEX    waveFormatEx{};
-	HANDLE hWait{};
+	if (hWaveOut)
+	{
+		waveOutReset(hWaveOut);
+		for (auto& header : waveHeader)
+			waveOutUnprepareHeader(hWaveOut, &header, sizeof(WAVEHDR));
+		waveOutClose(hWaveOut);
+		hWaveOut = NULL;
+	}
+	if (hBufferDone)
+	{
+		CloseHandle(hBufferDone);
+		hBufferDone = NULL;
+	}
+}
 
+void WaveOutSink::Worker(AudioStream* stream)
+{
+	//Buffers are rendered in this thread in realtime mode, don't let the GUI delay them.
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+	while (!quit)
+	{
+		WaitForSingleObject(hBufferDone, 100);
+		//Refill every buffer the device has played.
+		for (auto& header : waveHeader)
+		{
+			if ((header.dwFlags & WHDR_DONE) && !stream->IsFinished())
+			{
+				stream->Pull((int16_t*)header.lpData, DEVICE_BUFFER_FRAMES);
+				waveOutWrite(hWaveOut, &header, sizeof(WAVEHDR));
+			}
+		}
+	}
+}
+
+class PlaybackThread : public CThread
+{
+protected:
 	bool playing{ false };
 public:
 	UINT Worker(LPVOID pParam);
@@ -71,58 +152,22 @@ void PlaybackThread::OnExitingThread()
 UINT PlaybackThread::Worker(LPVOID pParam)
 {
 	MidiPlayback* mpbPointer = (MidiPlayback*)pParam;
-	bShouldPrepareData = false;
-	mpbPointer->Rewind();
 	playing = true;
 
-	waveFormatEx.wFormatTag = WAVE_FORMAT_PCM;	//PCM 
-	waveFormatEx.nChannels = 2;
-	waveFormatEx.nSamplesPerSec = static_cast<DWORD>(SAMPLE_RATE);	//
-	waveFormatEx.nBlockAlign = waveFormatEx.nChannels * 2;	//in bytes
-	waveFormatEx.nAvgBytesPerSec = static_cast<DWORD>(SAMPLE_RATE) * waveFormatEx.nBlockAlign; //
-	waveFormatEx.wBitsPerSample = 16;
-	waveFormatEx.cbSize = 0;
-
-	waveOutOpen(&hWaveOut, WAVE_MAPPER, &waveFormatEx, (DWORD)WaveOutProc, 0L, CALLBACK_FUNCTION);//Get a handle for wave playback.
-
-	int currentBuffer = 0;
-
-	waveHeader[0].lpData = buffers[0];
-	waveHeader[0].dwBufferLength = BUFFER_SIZE;
-	waveHeader[0].dwFlags = 0L;
-	waveHeader[0].dwLoops = 0L;
-	waveOutPrepareHeader(hWaveOut, &waveHeader[0], sizeof(WAVEHDR));
-
-	waveHeader[1].lpData = buffers[1];
-	waveHeader[1].dwBufferLength = BUFFER_SIZE;
-	waveHeader[1].dwFlags = 0L;
-	waveHeader[1].dwLoops = 0L;
-	waveOutPrepareHeader(hWaveOut, &waveHeader[1], sizeof(WAVEHDR));
-
-	bool continuePlaying = true;
-	mpbPointer->PrepareBuffer(buffers[0], BUFFER_SIZE);
-	continuePlaying = mpbPointer->PrepareBuffer(buffers[1], BUFFER_SIZE);
-	waveOutWrite(hWaveOut, &waveHeader[0], sizeof(WAVEHDR));
-	waveOutWrite(hWaveOut, &waveHeader[1], sizeof(WAVEHDR));
-
-	while (continuePlaying && !SenseAsynExit())
+	AudioStream stream;
+	WaveOutSink sink;
+	stream.SetRealtime(true);
+	mpbPointer->printMessages = false;
+	if (stream.Start(mpbPointer, &sink))
 	{
-		if (bShouldPrepareData)
-		{
-			bShouldPrepareData = false;
-			continuePlaying = mpbPointer->PrepareBuffer(pWaveHeader->lpData, BUFFER_SIZE);
-			waveOutUnprepareHeader(hWaveOut, pWaveHeader, sizeof(WAVEHDR));
-			waveOutPrepareHeader(hWaveOut, pWaveHeader, sizeof(WAVEHDR));
-			waveOutWrite(hWaveOut, pWaveHeader, sizeof(WAVEHDR));
-		}
-		else
+		while (!stream.IsFinished() && !SenseAsynExit())
 			Sleep(5);
-	}
-
-	if (!SenseAsynExit())
-		Sleep(500);
 
-	waveOutClose(hWaveOut);
+		//Let the device play out its buffers.
+		if (!SenseAsynExit())
+			Sleep(500);
+	}
+	stream.Stop();
 	return 0;
 }
 